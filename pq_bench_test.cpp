@@ -7,33 +7,343 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdarg.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <libgen.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sys/utsname.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include <linux/perf_event.h>
 #include <time.h>
 #include <math.h>
 #include <float.h>
+#include <stdint.h>
 #include <vector>
 #include <map>
 #include <string>
 #include <algorithm>
+#include <random>
+#include <numeric>
+#include <atomic>
+#include <functional>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 
 #include <libpq-fe.h> 
 
+// USDT probes (provider pq_bench) for tracing the benchmark from outside,
+// e.g. with bpftrace; each is a single nop unless a tracer is attached. 
+// Without sys/sdt.h (systemtap-sdt-dev) at build time, they compile to
+// nothing, the arguments being only referenced, not to leave them unused
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#endif
+#endif
+#ifndef DTRACE_PROBE1
+#define DTRACE_PROBE1(provider, name, a1) \
+    do { (void)(a1); } while(0)
+#define DTRACE_PROBE2(provider, name, a1, a2) \
+    do { (void)(a1); (void)(a2); } while(0)
+#define DTRACE_PROBE3(provider, name, a1, a2, a3) \
+    do { (void)(a1); (void)(a2); (void)(a3); } while(0)
+#define DTRACE_PROBE4(provider, name, a1, a2, a3, a4) \
+    do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } while(0)
+#endif
+
 // max allowed number of workers; set as deemed reasonable
 const int max_num_workers = 50;
 int dbg = 0; // if 1, some debug info is printed
 
+// postgres connection info, for the workers and the control connection
+// modify this per your setup
+// to avoid exposing password in the code, use the ~/.pgpass file
+// I hardcoded the info per my setup, yours is probably different
+const int conn_info_line_no = __LINE__ + 1;
+const char *conn_info = "dbname=homework user=postgres password=postgres";
+
+// run length control; if run_duration is 0, each worker makes a single
+// pass over its slice of the input, otherwise the workers keep cycling
+// through their slices until the deadline
+double run_duration = 0;  // in seconds
+int shuffle_passes = 0;   // if 1, reshuffle worker's queries between passes
+double warmup_time = 0;   // initial period (seconds) excluded from stats
+int warmup_count = 0;     // queries run by each worker before measuring
+int num_iterations = 1;   // measured passes (or durations) repeated
+
+// the number of resamples for bootstrap confidence intervals
+const int bootstrap_resamples = 1000;
+// resamples of larger runs draw only this many times, see bootstrap_ci()
+const size_t bootstrap_max_sample = 10000;
+
+// significance level for statistical tests
+const double significance_level = 0.05;
+
+// the benchmarked query; {host}, {start_time} and {end_time} are replaced
+// by the values from the input CSV
+const char *default_query_template = 
+    "SELECT time_bucket('1 minute', ts), MIN(usage), MAX(usage) "
+    "FROM cpu_usage "
+    "WHERE host='{host}' AND ts BETWEEN '{start_time}' AND '{end_time}' "
+    "GROUP BY 1";
+
+// A/B comparison mode: if variant B is given, both variants are run
+// for each input row on the same connection, and their times are paired
+const char *query_templates[2] = {default_query_template, NULL};
+int num_variants = 1;    // 2 in A/B mode
+int ab_random_order = 0; // if 0, the variant running first alternates
+
+// baseline files to save this run's results to and compare them against
+const char *save_baseline_file = NULL;
+const char *compare_baseline_file = NULL;
+
+// allowed degradation against the baseline, in percent,
+// indexed by RegressionMetric
+double regression_thresholds[] = {5, 5, 5};
+
+enum RegressionMetric
+{
+    METRIC_P50,
+    METRIC_P99,
+    METRIC_QPS,
+    NUM_METRICS
+};
+
+// exit code when a significant regression against the baseline is found
+const int exit_regression = 2;
+
+// machine-readable summary ("json" or "csv"), written to output_file or,
+// if that's not given, to standard output, with the human-readable 
+// report moved to standard error
+const char *output_format = NULL;
+const char *output_file = NULL;
+FILE *report_out = stdout;
+
+// percentiles included in machine-readable summary
+const double summary_percentiles[] = {50, 90, 95, 99, 99.9};
+const char *summary_percentile_names[] = {"p50", "p90", "p95", "p99", "p99_9"};
+const int num_summary_percentiles = 5;
+
+// per-query trace: if trace_file is set, every trace_sample-th query of 
+// each worker is recorded to it; trace_dump_file is the trace to convert
+// to CSV instead of running the benchmark
+const char *trace_file = NULL;
+int trace_sample = 1;
+const char *trace_dump_file = NULL;
+
+// if 1, the report includes per-worker and per-host breakdown
+int show_breakdown = 0;
+
+// Chrome trace-event file to write the timeline of workers' activity to
+const char *timeline_file = NULL;
+
+// if 1, queries are sent asynchronously, timestamping their phases:
+// sending, waiting for the first byte of the response (server time),
+// receiving the rest of the result, and processing it on the client
+int measure_phases = 0;
+
+enum QueryPhase
+{
+    PHASE_SEND,
+    PHASE_SERVER,
+    PHASE_TRANSFER,
+    PHASE_PROCESSING,
+    NUM_PHASES
+};
+
+const char *phase_names[NUM_PHASES] = {"send", "server", "transfer", "processing"};
+
+// if 1, each worker counts hardware events (in user space) with 
+// perf_event_open, attributing them to the stages of its query loop
+int perf_counters = 0;
+
+enum LoopStage
+{
+    STAGE_RENDER,  // generating the query
+    STAGE_SEND,    // writing it to the socket
+    STAGE_WAIT,    // until the response starts arriving
+    STAGE_DECODE,  // receiving and parsing the result, and freeing it
+    STAGE_STATS,   // recording the query, and the loop itself
+    NUM_STAGES
+};
+
+const char *stage_names[NUM_STAGES] = {"render", "send", "wait", "decode", "stats"};
+
+// if 1, pg_stat_statements is reset at the start of the run, and its 
+// stats are reported after the run along with the client's timings
+int statement_stats = 0;
+
+// if above 0, a sampler thread polls pg_stat_activity for the wait 
+// events of the workers' backends at this interval (in seconds)
+double wait_sample_interval = 0;
+const int wait_report_top = 5; // events shown per iteration or interval
+
+// if above 0, the wait event profile is also reported for each interval 
+// of this length (in seconds) since the start of the run, instead of 
+// for each iteration
+double wait_report_interval = 0;
+
+// if above 0, a monitor thread snapshots the server's background 
+// activity (checkpoints, vacuums, buffer writes and WAL) at this interval 
+// (in seconds), and latency of each interval is reported along with it; 
+// an interval's tail is slow if its p99 exceeds the median of intervals' 
+// p99 by this ratio
+double background_interval = 0;
+const double slow_interval_ratio = 1.5;
+const int background_report_top = 20; // slow intervals listed
+
+// if set, the slowest queries (explain_top of them) are re-run after 
+// the run with EXPLAIN ANALYZE, and their plans written to this file
+const char *explain_file = NULL;
+int explain_top = 5;
+
+// if 1, the chunks of the hypertable are loaded at startup, each 
+// query's time range is mapped to the number of chunks it touches, and
+// latency is reported by that number, and by the number of result rows
+int chunk_analysis = 0;
+const char *chunks_query = 
+    "SELECT to_char(range_start, 'YYYY-MM-DD HH24:MI:SS'), "
+    "to_char(range_end, 'YYYY-MM-DD HH24:MI:SS') "
+    "FROM timescaledb_information.chunks WHERE hypertable_name = 'cpu_usage'";
+
+// if 1, the server is expected on this host, and each worker reads CPU 
+// times and I/O of its backend from /proc before and after each of its 
+// measured queries, to report them next to the latencies
+int backend_usage = 0;
+
+// if above 0, metrics of the run are served in Prometheus text format 
+// at http://127.0.0.1:<port>/metrics while it lasts
+int metrics_port = 0;
+
+// if above 0, this fraction of the input rows is picked for plan 
+// tracking: every measured execution of them is followed, on a separate
+// connection of the worker, by EXPLAIN (FORMAT JSON) of the query, and 
+// the latency of the execution is accounted to the plan's structure; 
+// the time, CPU and allocations of EXPLAIN are left out of the run's
+// accounting
+double plan_fraction = 0;
+
+// if 1, latency is modeled against the time range length and the result
+// rows of the queries, flagging those far slower than the model predicts:
+// by more than outlier_sigmas robust standard deviations of the residuals
+int latency_model = 0;
+const double outlier_sigmas = 5;
+const int outlier_report_top = 5;
+
+// if 1, malloc() and friends (interposed by this program, for libpq 
+// as well) count the allocations of each thread, and time they take
+int alloc_accounting = 0;
+
+// allocations of a thread; plain data, as it's updated from malloc()
+struct AllocStats
+{
+    uint64_t allocs; // including reallocs
+    uint64_t frees;
+    uint64_t bytes;  // requested
+    int64_t ns;      // spent in the allocator
+};
+
+thread_local AllocStats thread_allocs;
+
+enum PerfCounter
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    NUM_PERF_COUNTERS
+};
+
+// source of all timestamps taken by the benchmark (in integer ns): 
+// CLOCK_MONOTONIC_RAW, or the CPU's invariant TSC, which is cheaper to 
+// read, calibrated against it at startup
+enum ClockSource
+{
+    CLOCK_SOURCE_RAW,
+    CLOCK_SOURCE_TSC
+};
+
+int clock_source = CLOCK_SOURCE_RAW;
+
+// TSC calibration: ns = tsc_base_ns + ((tsc - tsc_base) * tsc_mult) >> 32
+uint64_t tsc_base = 0;
+int64_t tsc_base_ns = 0;
+uint64_t tsc_mult = 0;
+const int64_t tsc_calibration_ns = 100000000;
+
+// noise floor self-test run at startup: back-to-back clock readings,
+// spinning on the clock for a while, counting gaps above the stall 
+// threshold as time the thread wasn't running, and short sleeps
+const int noise_readings = 10000;
+const int64_t noise_spin_ns = 100000000;
+const int64_t noise_stall_ns = 10000;
+const int noise_sleeps = 100;
+const int64_t noise_sleep_ns = 100000;
+
+// a worker on CPU for more than this share of the run (in percent) is
+// likely the bottleneck itself, rather than the server
+const double client_busy_warn_pct = 80;
+
+// codes for the options that only have a long form
+enum LongOnlyOption
+{
+    OPT_DURATION = 256,
+    OPT_SHUFFLE,
+    OPT_WARMUP_TIME,
+    OPT_WARMUP,
+    OPT_ITERATIONS,
+    OPT_QUERY_A,
+    OPT_QUERY_B,
+    OPT_AB_ORDER,
+    OPT_SAVE_BASELINE,
+    OPT_COMPARE_BASELINE,
+    OPT_THRESHOLD,
+    OPT_FORMAT,
+    OPT_OUTPUT,
+    OPT_TRACE,
+    OPT_TRACE_SAMPLE,
+    OPT_TRACE_DUMP,
+    OPT_BREAKDOWN,
+    OPT_TIMELINE,
+    OPT_PHASES,
+    OPT_CLOCK,
+    OPT_PERF_COUNTERS,
+    OPT_ALLOC_STATS,
+    OPT_PG_STAT_STATEMENTS,
+    OPT_WAIT_EVENTS,
+    OPT_WAIT_EVENTS_REPORT,
+    OPT_EXPLAIN,
+    OPT_EXPLAIN_TOP,
+    OPT_CHUNKS,
+    OPT_LATENCY_MODEL,
+    OPT_BACKGROUND,
+    OPT_PLANS,
+    OPT_BACKEND_USAGE,
+    OPT_METRICS_PORT
+};
+
 // host => worker assignment
 typedef std::map<std::string, int> HostWorkerMap;
 
 struct QueryParam
 {
+    QueryParam(): chunks(-1) {}
     std::string host;
     std::string start_time;
     std::string end_time;
+    int chunks; // touched by the time range, -1 if unknown
 };
 
 // variables of this type will be passed to individual workers
@@ -44,6 +354,38 @@ typedef std::vector<QueryParam> QueryParamArray;
 // it is indexed by worker number
 typedef std::vector<QueryParamArray> AllQueryParamArrays;
 
+// what execute_query() reports about the result
+struct QueryResult
+{
+    int rows;
+    size_t bytes; // memory taken by the result in libpq
+    int64_t received_ns; // when the result was received
+    
+    // only in phase measurement mode
+    int64_t sent_ns;       // when the query was sent
+    int64_t first_byte_ns; // when the response started arriving
+};
+
+// server-side stats of a normalized query, from pg_stat_statements; 
+// times are in seconds, buffers are totals
+struct StatementStats
+{
+    std::string query;
+    long calls;
+    double exec_mean;
+    double exec_stddev;
+    double plan_mean;
+    long long shared_hits;
+    long long shared_reads;
+};
+
+typedef std::vector<StatementStats> StatementStatsArray;
+
+// samples of backends per wait event ("type:event", or "CPU" for active
+// backends not waiting), indexed by iteration
+typedef std::map<std::string, uint64_t> WaitEventProfile;
+typedef std::vector<WaitEventProfile> WaitEventProfileArray;
+
 // structure to pass to worker function
 struct ThreadElem
 {
@@ -52,33 +394,496 @@ struct ThreadElem
 };
 
 
+// span of worker's activity on the timeline, in now_ns() time: 
+// connection (with param_index of -1), or a query, with its result 
+// received at result_ns, and processed by end_ns
+struct TimelineEvent
+{
+    int64_t start_ns;
+    int64_t result_ns;
+    int64_t end_ns;
+    int param_index;
+    int variant;
+};
+
+typedef std::vector<TimelineEvent> TimelineEventArray;
+
+// single measured query
+struct QuerySample
+{
+    int64_t time_ns;
+    int iteration; // 0-based
+    int variant;   // 0 for A, 1 for B
+    int param_index; // in the worker's slice of the input
+    int rows;
+    int64_t end_ns; // since the start of the run
+};
+
+typedef std::vector<QuerySample> QuerySampleArray;
+
+// cumulative counters of the server's background activity at a moment
+// of the run, and the vacuums and checkpoint running at it
+struct BackgroundSnapshot
+{
+    int64_t time_ns; // since the start of the run
+    int64_t checkpoints;
+    int64_t buffers_written; // by checkpointer and background writer
+    int64_t wal_bytes;
+    int vacuums;
+    int checkpoint_running;
+};
+
+typedef std::vector<BackgroundSnapshot> BackgroundSnapshotArray;
+
+// latency histogram with logarithmic buckets: each power of 2 (in ns) 
+// is split into 2^histogram_sub_bits linear sub-buckets, so that the 
+// relative error of values taken from it is below 0.4%
+const int histogram_sub_bits = 7;
+const int histogram_max_bits = 44; // values are capped at ~4.9 hours
+const int histogram_num_buckets = 
+    (histogram_max_bits - histogram_sub_bits + 1) << histogram_sub_bits;
+
+struct LatencyHistogram
+{
+    LatencyHistogram(): counts(histogram_num_buckets), total(0), 
+        sum(0), min(DBL_MAX), max(0) {}
+    void record(int64_t ns);
+    void merge(const LatencyHistogram &other);
+    double percentile(double pct) const;
+    static int bucket_index(int64_t ns);
+    static double bucket_value(int index);
+    
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    
+    // exact, in seconds
+    double sum;
+    double min;
+    double max;
+};
+
+// stats of queries for the same host
+struct HostStats
+{
+    std::string host;
+    int worker;
+    int queries;
+    double total_time;
+    double median_time;
+    double p99_time;
+};
+
+typedef std::vector<HostStats> HostStatsArray;
+
+// noise floor of the client's measurements, in ns: the cost and 
+// granularity of reading the clock, stalls of a thread spinning on 
+// the CPU (preemption, interrupts), and delay of waking up from sleep
+struct NoiseFloor
+{
+    NoiseFloor(): timer_overhead(0), timer_resolution(0), max_stall(0),
+        stalled_pct(0), wakeup_p50(0), wakeup_p99(0) {}
+    int64_t timer_overhead;
+    int64_t timer_resolution;
+    int64_t max_stall;
+    double stalled_pct; // of the spinning time
+    int64_t wakeup_p50;
+    int64_t wakeup_p99;
+};
+
+// what the run ran against: server's version and settings, the table's
+// layout and size, and the client machine, as named values in the 
+// order of collection; the values that couldn't be found are left out
+typedef std::vector<std::pair<std::string, std::string> > Environment;
+
+// results of a run, for the machine-readable summary; histogram, wall time
+// and throughput are also what is persisted in the baseline files
+struct RunSummary
+{
+    RunSummary(): workers(0), queries(0), warmup_queries(0), passes(0), 
+        wall_time(0), throughput(0), imbalance(0), last_finish(0),
+        client_cpu_time(0), peak_rss_kb(0) {}
+    std::string input;
+    int workers;
+    int queries;
+    int warmup_queries;
+    int passes;
+    struct timespec start_time; // wall clock
+    struct timespec end_time;
+    LatencyHistogram histogram;
+    LatencyHistogram variant_histograms[2];
+    double wall_time;
+    double throughput;
+    double imbalance;   // max/mean busy time of workers
+    double last_finish; // finish time of the last worker, since run start
+    HostStatsArray host_stats;
+    NoiseFloor noise_floor;
+    double client_cpu_time; // of all workers
+    long peak_rss_kb;       // of the whole process
+    Environment environment;
+};
+
+// resources used by a worker thread, from the start of the run
+struct ThreadUsage
+{
+    ThreadUsage(): cpu_ns(0), voluntary_switches(0), involuntary_switches(0) {}
+    int64_t cpu_ns;
+    long voluntary_switches;   // mostly waiting for the server
+    long involuntary_switches; // preempted
+};
+
+// group of hardware counters of the calling thread; the counts are
+// accumulated per loop stage, each mark() charging the events since 
+// the previous one to the stage that has just ended
+struct PerfCounters
+{
+    PerfCounters(): queries(0)
+    {
+        for(int c = 0; c < NUM_PERF_COUNTERS; c++)
+        {
+            fds[c] = -1;
+            last[c] = 0;
+            for(int i = 0; i < NUM_STAGES; i++)
+                counts[i][c] = 0;
+        }
+    }
+    int open();
+    void close();
+    void reset();
+    void clear();
+    void mark(int stage);
+    void merge(const PerfCounters &other);
+    
+    int fds[NUM_PERF_COUNTERS]; // the first one is the group leader
+    uint64_t last[NUM_PERF_COUNTERS];
+    uint64_t counts[NUM_STAGES][NUM_PERF_COUNTERS];
+    uint64_t queries;
+};
+
+// one of the slowest queries, kept in a short list by each worker
+struct SlowQuery
+{
+    int64_t time_ns;
+    int worker;
+    int param_index; // in the worker's slice of the input
+    int variant;
+    
+    bool operator>(const SlowQuery &other) const 
+    { 
+        return time_ns > other.time_ns; 
+    }
+};
+
+typedef std::vector<SlowQuery> SlowQueryArray;
+
+// resource usage of a backend, from /proc/<pid>/stat and /proc/<pid>/io,
+// cumulative or accumulated over queries
+struct BackendUsage
+{
+    BackendUsage(): user_ticks(0), system_ticks(0), read_chars(0), 
+        read_bytes(0), write_bytes(0) {}
+    int64_t user_ticks; // in clock ticks
+    int64_t system_ticks;
+    int64_t read_chars;  // by read() calls, incl. those served from cache
+    int64_t read_bytes;  // from the storage
+    int64_t write_bytes; // to the storage
+};
+
+// open /proc files of a worker's backend, read again for each query
+struct BackendProc
+{
+    int stat_fd;
+    int io_fd; // -1 if not readable, i.e. the backend runs as another user
+};
+
+// upper bounds of the latency buckets of the metrics, in seconds
+const double metrics_buckets[] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+const int num_metrics_buckets = sizeof(metrics_buckets) / sizeof(metrics_buckets[0]);
+
+// a worker's counters for the metrics endpoint; each worker is the only 
+// writer of its own, so they're updated with relaxed loads and stores
+// instead of locked read-modify-writes, and the endpoint reads them at
+// any time
+struct LiveMetrics
+{
+    LiveMetrics(): busy_ns(0), in_flight(0)
+    {
+        for(int v = 0; v < 2; v++)
+        {
+            queries[v].store(0);
+            sum_ns[v].store(0);
+            for(int b = 0; b <= num_metrics_buckets; b++)
+                buckets[v][b].store(0);
+        }
+    }
+    
+    static void add(std::atomic<uint64_t> &counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, 
+            std::memory_order_relaxed);
+    }
+    
+    // counts the query in its bucket, the last one being above all bounds
+    void record(int variant, int64_t ns)
+    {
+        int b = 0;
+        while(b < num_metrics_buckets && ns > metrics_buckets[b] * 1e9)
+            b++;
+        add(buckets[variant][b], 1);
+        add(sum_ns[variant], ns);
+        add(queries[variant], 1);
+    }
+    
+    alignas(64) std::atomic<uint64_t> queries[2]; // per variant
+    std::atomic<uint64_t> sum_ns[2];
+    std::atomic<uint64_t> buckets[2][num_metrics_buckets + 1];
+    std::atomic<uint64_t> busy_ns; // in queries, incl. warm-up
+    std::atomic<int> in_flight;
+};
+
+// executions of a query under one plan structure, keyed by its hash
+struct PlanUsage
+{
+    std::string structure;
+    int variant;
+    int64_t first_ns; // completion of the first and the last execution,
+    int64_t last_ns;  // since the start of the run
+    std::vector<double> times;
+};
+
+typedef std::map<uint64_t, PlanUsage> PlanUsageMap;
+
+// traffic of a worker's connection over the measured loop, and its
+// state at the end, from TCP_INFO
+struct NetStats
+{
+    NetStats(): tcp(0), bytes_sent(0), bytes_received(0), rtt_us(0), 
+        rtt_var_us(0), retransmits(0), cwnd(0) {}
+    int tcp; // 0 if the connection isn't TCP, with no stats then
+    uint64_t bytes_sent;     // acknowledged by the server
+    uint64_t bytes_received;
+    uint32_t rtt_us;         // smoothed
+    uint32_t rtt_var_us;
+    uint32_t retransmits;    // over the life of the connection
+    uint32_t cwnd;           // in segments
+};
+
 // final stats from individual worker
 struct WorkerOutput 
 {
-    WorkerOutput(): total_queries(0), total_time(0), min_time(0), max_time(0) {}
+    WorkerOutput(): total_queries(0), total_time(0), min_time(0), max_time(0),
+        warmup_queries(0), passes(0), finish_time(0), usage_time(0),
+        loop_queries(0), allocs(), libpq_allocs(), plan_time(0) {}
     double total_queries;
     double total_time;
     double min_time;
     double max_time;
-    std::vector<double> all_times;
+    int warmup_queries; // executed, but excluded from stats
+    int passes;         // passes started over the worker's slice
+    double finish_time; // since the start of the run
+    ThreadUsage usage;
+    double usage_time;  // the time usage covers
+    int loop_queries;         // run in the measured loop, incl. warm-up time
+    AllocStats allocs;        // in the measured loop
+    AllocStats libpq_allocs;  // the part of them in executing the queries
+    NetStats net;
+    BackendUsage backend; // over the measured queries
+    SlowQueryArray slowest;
+    PlanUsageMap plans;
+    double plan_time; // spent in tracking the plans, not in the run
+    QuerySampleArray samples;
+    TimelineEventArray timeline;
+    std::vector<double> paired_diffs; // B - A times, in A/B mode
+    LatencyHistogram variant_histograms[2];
+    LatencyHistogram phase_histograms[NUM_PHASES];
+    PerfCounters perf;
 };
 
 // each worker will write its stats to according element in this array
 // (the index is the worker number)
 typedef std::vector<WorkerOutput> WorkerOutputArray;
 
+// trace of a single query; timestamps are in now_ns() time
+struct TraceRecord
+{
+    int64_t send_ns;
+    int64_t first_byte_ns; // 0 if not measured
+    int64_t complete_ns;
+    uint64_t bytes;
+    uint32_t param_index;  // index in the worker's slice of the input
+    uint32_t rows;
+    uint16_t worker;
+    uint16_t iteration;
+    uint8_t variant;
+};
+
+// single-producer single-consumer lock-free ring of trace records:
+// the worker pushes records, the trace writer thread drains them; 
+// if the ring is full, the record is dropped rather than blocking
+const uint64_t trace_ring_size = 1 << 14; // power of 2
+
+struct TraceRing
+{
+    TraceRing(): head(0), cached_tail(0), dropped(0), tail(0) {}
+    void push(const TraceRecord &record);
+    
+    TraceRecord records[trace_ring_size];
+    
+    // head and tail are on separate cache lines, not to bounce
+    // between the producer and the consumer
+    alignas(64) std::atomic<uint64_t> head; // next to write
+    uint64_t cached_tail;                   // producer's view of tail
+    uint64_t dropped;
+    alignas(64) std::atomic<uint64_t> tail; // next to read
+};
+
+// trace file is a header with the workers' input slices (to resolve 
+// param_index), followed by blocks of records, stored column by column,
+// and an end block; all numbers are in host byte order
+const char trace_magic[8] = {'P', 'Q', 'B', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t trace_version = 1;
+const uint32_t trace_block_tag = 0x4b4c4254; // "TBLK"
+const uint32_t trace_end_tag = 0x444e4554;   // "TEND"
+const size_t trace_block_records = 4096;
+
 // forward declarations
 void error_out(const char * format, ...);
 void print_usage(char *prog_name);
 void parse_query_param_line(char *line, int line_no, QueryParam &param);
 void *worker_func(void *arg);
 void exit_gracefully(PGconn *conn);
-void execute_query(PGconn *conn, const char *query);
+void execute_query(PGconn *conn, const char *query, QueryResult &result);
+PGresult *execute_query_phased(PGconn *conn, const char *query, 
+    QueryResult &result);
+int wait_for_input(PGconn *conn);
+int parse_duration(const char *str, double &seconds);
+void render_query(const char *tmpl, const QueryParam &param, 
+    char *query, size_t size);
+void sync_workers(int iteration);
+double percentile(const std::vector<double> &sorted, double pct);
+void bootstrap_ci(const std::vector<double> &times, double pct, 
+    double &low, double &high);
+void print_confidence_report(std::vector<double> &all_times,
+    std::vector<std::vector<double> > &iteration_times);
+double wilcoxon_signed_rank(const std::vector<double> &diffs, double &z);
+void print_ab_report(std::vector<double> *variant_times, 
+    std::vector<double> &paired_diffs);
+int parse_thresholds(const char *str);
+void save_baseline(const char *file_name, const RunSummary &summary);
+void load_baseline(const char *file_name, RunSummary &summary);
+double mann_whitney(const LatencyHistogram &a, const LatencyHistogram &b, 
+    double &z);
+double kolmogorov_smirnov(const LatencyHistogram &a, const LatencyHistogram &b,
+    double &d);
+int compare_with_baseline(const char *file_name, const RunSummary &baseline,
+    const RunSummary &current);
+void format_timestamp(const struct timespec &ts, char *buf, size_t size);
+void write_json_string(FILE *file, const char *str);
+void write_csv_string(FILE *file, const char *str);
+void write_json_stats(FILE *file, const LatencyHistogram &histogram);
+void write_csv_stats(FILE *file, const char *section, const char *entity, 
+    const LatencyHistogram &histogram);
+void write_summary(const RunSummary &summary);
+void start_trace_writer();
+void stop_trace_writer();
+void *trace_writer_func(void *arg);
+void dump_trace(const char *file_name);
+void compute_host_stats(HostStatsArray &host_stats);
+void print_breakdown(const RunSummary &summary);
+void write_timeline(const char *file_name);
+void print_phase_report(const LatencyHistogram *phase_histograms);
+int64_t now_ns();
+void init_clock();
+const char *clock_source_name();
+void measure_noise_floor(NoiseFloor &noise);
+void print_noise_floor(const NoiseFloor &noise);
+void get_thread_usage(ThreadUsage &usage);
+void print_client_usage(const RunSummary &summary);
+void print_perf_report(const PerfCounters &perf);
+void add_alloc_stats(AllocStats &sum, const AllocStats &end, 
+    const AllocStats &start);
+void print_alloc_report(const NoiseFloor &noise);
+int get_tcp_info(PGconn *conn, struct tcp_info &info);
+void print_net_report(const RunSummary &summary);
+PGconn *connect_db(int worker_no);
+PGresult *control_query(const char *sql);
+void collect_statement_stats(StatementStatsArray &stats);
+void query_skeleton(const char *query, std::string &skeleton);
+void print_statement_report(const StatementStatsArray &stats, 
+    const RunSummary &summary);
+void start_wait_sampler();
+void stop_wait_sampler();
+void *wait_sampler_func(void *arg);
+void print_wait_report();
+void start_background_monitor();
+void stop_background_monitor();
+void *background_monitor_func(void *arg);
+void print_background_report();
+void add_slow_query(SlowQueryArray &slowest, const SlowQuery &slow);
+void explain_slowest(const char *file_name);
+int parse_timestamp(const char *str, time_t &seconds);
+void map_chunks();
+void print_chunk_report();
+void print_latency_model();
+void track_plan(PGconn *conn, const char *query, int variant, int64_t end_ns,
+    double time, PlanUsageMap &plans);
+void print_plan_report();
+void open_backend_proc(int pid, int worker_no, BackendProc &proc);
+void read_backend_usage(const BackendProc &proc, BackendUsage &usage);
+void print_backend_report();
+void collect_environment(Environment &environment);
+void start_metrics_server();
+void stop_metrics_server();
+void *metrics_server_func(void *arg);
+void print_environment_diff(const Environment &baseline, 
+    const Environment &current);
 
 // global data area
 AllQueryParamArrays all_query_param_arrays;
 WorkerOutputArray worker_output_array;
 
+// workers wait on this barrier once connected and warmed up, and again
+// before each iteration, so that the measured run and every iteration
+// start simultaneously for all of them; the start times are set by the
+// last worker to arrive
+pthread_barrier_t sync_barrier;
+int64_t run_start_ns;
+struct timespec run_start_wall;
+int64_t iteration_start_ns;
+
+// connection of the main thread, for server's stats; it's also used by
+// the last worker to arrive at the start of the run, while main waits
+PGconn *control_conn = NULL;
+
+// PIDs of the workers' backends, indexed by worker number, set before
+// the run starts; the sampler thread reads them once the iteration being 
+// run is set (by the last worker to arrive at its start)
+std::vector<int> backend_pids;
+std::atomic<int> run_iteration(-1);
+pthread_t wait_sampler_thread;
+std::atomic<int> wait_sampler_stop(0);
+WaitEventProfileArray wait_profiles;
+uint64_t wait_samples = 0; // polls of pg_stat_activity
+pthread_t background_thread;
+std::atomic<int> background_stop(0);
+BackgroundSnapshotArray background_snapshots;
+
+// rings of the trace, indexed by worker number, and their writer
+std::vector<TraceRing*> trace_rings;
+pthread_t trace_writer_thread;
+std::atomic<int> trace_stop(0);
+double trace_push_ns = 0; // cost of tracing a query, measured at start
+
+// counters of the workers, indexed by worker number, and the thread 
+// serving them
+std::vector<LiveMetrics*> live_metrics;
+pthread_t metrics_thread;
+std::atomic<int> metrics_stop(0);
+
+// the worker's counters, for execute_query() to mark the stages with
+thread_local PerfCounters *worker_perf = NULL;
+
 int main(int argc, char* argv[]) 
 {
     errno = 0; // workouround for libpq errno problem, need to reset
@@ -87,6 +892,7 @@ int main(int argc, char* argv[])
     
     int opt;
     FILE *in_file = stdin;
+    const char *in_file_name = "-";
     int num_workers = 0;
     char prog_name[256];
     
@@ -97,7 +903,45 @@ int main(int argc, char* argv[])
         print_usage(prog_name);
     }    
     
-    while((opt = getopt(argc, argv, ":hvn:f:")) != -1)  
+    static const struct option long_options[] = 
+    {
+        {"duration",    required_argument, NULL, OPT_DURATION},
+        {"shuffle",     no_argument,       NULL, OPT_SHUFFLE},
+        {"warmup-time", required_argument, NULL, OPT_WARMUP_TIME},
+        {"warmup",      required_argument, NULL, OPT_WARMUP},
+        {"iterations",  required_argument, NULL, OPT_ITERATIONS},
+        {"query-a",     required_argument, NULL, OPT_QUERY_A},
+        {"query-b",     required_argument, NULL, OPT_QUERY_B},
+        {"ab-order",    required_argument, NULL, OPT_AB_ORDER},
+        {"save-baseline",    required_argument, NULL, OPT_SAVE_BASELINE},
+        {"compare-baseline", required_argument, NULL, OPT_COMPARE_BASELINE},
+        {"threshold",        required_argument, NULL, OPT_THRESHOLD},
+        {"format",           required_argument, NULL, OPT_FORMAT},
+        {"output",           required_argument, NULL, OPT_OUTPUT},
+        {"trace",            required_argument, NULL, OPT_TRACE},
+        {"trace-sample",     required_argument, NULL, OPT_TRACE_SAMPLE},
+        {"trace-dump",       required_argument, NULL, OPT_TRACE_DUMP},
+        {"breakdown",        no_argument,       NULL, OPT_BREAKDOWN},
+        {"timeline",         required_argument, NULL, OPT_TIMELINE},
+        {"phases",           no_argument,       NULL, OPT_PHASES},
+        {"clock",            required_argument, NULL, OPT_CLOCK},
+        {"perf-counters",    no_argument,       NULL, OPT_PERF_COUNTERS},
+        {"alloc-stats",      no_argument,       NULL, OPT_ALLOC_STATS},
+        {"pg-stat-statements", no_argument,     NULL, OPT_PG_STAT_STATEMENTS},
+        {"wait-events",      required_argument, NULL, OPT_WAIT_EVENTS},
+        {"wait-events-report", required_argument, NULL, OPT_WAIT_EVENTS_REPORT},
+        {"explain",          required_argument, NULL, OPT_EXPLAIN},
+        {"explain-top",      required_argument, NULL, OPT_EXPLAIN_TOP},
+        {"chunks",           no_argument,       NULL, OPT_CHUNKS},
+        {"latency-model",    no_argument,       NULL, OPT_LATENCY_MODEL},
+        {"background",       required_argument, NULL, OPT_BACKGROUND},
+        {"plans",            required_argument, NULL, OPT_PLANS},
+        {"backend-usage",    no_argument,       NULL, OPT_BACKEND_USAGE},
+        {"metrics-port",     required_argument, NULL, OPT_METRICS_PORT},
+        {NULL, 0, NULL, 0}
+    };
+    
+    while((opt = getopt_long(argc, argv, ":hvn:f:", long_options, NULL)) != -1)  
     {  
         switch(opt)  
         {  
@@ -109,6 +953,7 @@ int main(int argc, char* argv[])
                 break;
             case 'f':  
                 in_file = fopen(optarg, "r");
+                in_file_name = optarg;
                 if(in_file == NULL) 
                 {
                     error_out("cannot open input file %s (errno=%d)", optarg, errno);
@@ -122,6 +967,188 @@ int main(int argc, char* argv[])
                     error_out("invalid value for argument -n: %s", optarg);
                 }
                 break;
+            case OPT_DURATION:
+                if(!parse_duration(optarg, run_duration) || run_duration == 0)
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --duration: %s", optarg);
+                }
+                break;
+            case OPT_SHUFFLE:
+                shuffle_passes = 1;
+                break;
+            case OPT_WARMUP_TIME:
+                if(!parse_duration(optarg, warmup_time))
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --warmup-time: %s", optarg);
+                }
+                break;
+            case OPT_WARMUP:
+                warmup_count = strtol(optarg, NULL, 10);
+                if(errno > 0 || warmup_count < 0)
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --warmup: %s", optarg);
+                }
+                break;
+            case OPT_ITERATIONS:
+                num_iterations = strtol(optarg, NULL, 10);
+                if(errno > 0 || num_iterations <= 0)
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --iterations: %s", optarg);
+                }
+                break;
+            case OPT_QUERY_A:
+                query_templates[0] = optarg;
+                break;
+            case OPT_QUERY_B:
+                query_templates[1] = optarg;
+                num_variants = 2;
+                break;
+            case OPT_AB_ORDER:
+                if(!strcmp(optarg, "random"))
+                    ab_random_order = 1;
+                else if(strcmp(optarg, "alternate"))
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --ab-order: %s", optarg);
+                }
+                break;
+            case OPT_SAVE_BASELINE:
+                save_baseline_file = optarg;
+                break;
+            case OPT_COMPARE_BASELINE:
+                compare_baseline_file = optarg;
+                break;
+            case OPT_THRESHOLD:
+                if(!parse_thresholds(optarg))
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --threshold: %s", optarg);
+                }
+                break;
+            case OPT_FORMAT:
+                if(strcmp(optarg, "json") && strcmp(optarg, "csv"))
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --format: %s", optarg);
+                }
+                output_format = optarg;
+                break;
+            case OPT_OUTPUT:
+                output_file = optarg;
+                break;
+            case OPT_TRACE:
+                trace_file = optarg;
+                break;
+            case OPT_TRACE_SAMPLE:
+                trace_sample = strtol(optarg, NULL, 10);
+                if(errno > 0 || trace_sample <= 0)
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --trace-sample: %s", optarg);
+                }
+                break;
+            case OPT_TRACE_DUMP:
+                trace_dump_file = optarg;
+                break;
+            case OPT_BREAKDOWN:
+                show_breakdown = 1;
+                break;
+            case OPT_TIMELINE:
+                timeline_file = optarg;
+                break;
+            case OPT_PHASES:
+                measure_phases = 1;
+                break;
+            case OPT_CLOCK:
+                if(!strcmp(optarg, "tsc"))
+                    clock_source = CLOCK_SOURCE_TSC;
+                else if(strcmp(optarg, "raw"))
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --clock: %s", optarg);
+                }
+                break;
+            case OPT_PERF_COUNTERS:
+                // the stages of sending and waiting are only separate
+                // when the query is sent asynchronously
+                perf_counters = 1;
+                measure_phases = 1;
+                break;
+            case OPT_ALLOC_STATS:
+                alloc_accounting = 1;
+                break;
+            case OPT_PG_STAT_STATEMENTS:
+                statement_stats = 1;
+                break;
+            case OPT_WAIT_EVENTS:
+                if(!parse_duration(optarg, wait_sample_interval) || 
+                    wait_sample_interval == 0)
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --wait-events: %s", optarg);
+                }
+                break;
+            case OPT_WAIT_EVENTS_REPORT:
+                if(!parse_duration(optarg, wait_report_interval) || 
+                    wait_report_interval == 0)
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --wait-events-report: %s", 
+                        optarg);
+                }
+                break;
+            case OPT_EXPLAIN:
+                explain_file = optarg;
+                break;
+            case OPT_EXPLAIN_TOP:
+                explain_top = strtol(optarg, NULL, 10);
+                if(errno > 0 || explain_top <= 0)
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --explain-top: %s", optarg);
+                }
+                break;
+            case OPT_CHUNKS:
+                chunk_analysis = 1;
+                break;
+            case OPT_LATENCY_MODEL:
+                latency_model = 1;
+                break;
+            case OPT_BACKGROUND:
+                if(!parse_duration(optarg, background_interval) || 
+                    background_interval == 0)
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --background: %s", optarg);
+                }
+                break;
+            case OPT_PLANS:
+            {
+                char *end;
+                plan_fraction = strtod(optarg, &end);
+                if(end == optarg || *end || 
+                    !(plan_fraction > 0 && plan_fraction <= 1))
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --plans: %s", optarg);
+                }
+                break;
+            }
+            case OPT_BACKEND_USAGE:
+                backend_usage = 1;
+                break;
+            case OPT_METRICS_PORT:
+                metrics_port = strtol(optarg, NULL, 10);
+                if(errno > 0 || metrics_port <= 0 || metrics_port > 65535)
+                {
+                    print_usage(prog_name);
+                    error_out("invalid value for argument --metrics-port: %s", optarg);
+                }
+                break;
             case ':':  
                 print_usage(prog_name);
                 error_out("option %s needs a value", argv[optind-1]); 
@@ -137,18 +1164,58 @@ int main(int argc, char* argv[])
         error_out("unexpected argument: %s", argv[optind]);  
     }
     
+    // converting a trace is all we do if asked to
+    if(trace_dump_file)
+    {
+        dump_trace(trace_dump_file);
+        return EXIT_SUCCESS;
+    }
+    
     if(num_workers == 0) 
     {
         print_usage(prog_name);
         error_out("missing mandatory argument -n <num_workers>");
     }
-
     
-    // now parse the input into internal representation 
-    // ready to be fed to workers, and assign hosts to workers,
-    // making sure each host's data is processed by the same worker
+    if(run_duration > 0 && warmup_time >= run_duration)
+    {
+        print_usage(prog_name);
+        error_out("--warmup-time must be shorter than --duration");
+    }
     
-    HostWorkerMap host_worker_map;
+    if(output_file && !output_format)
+    {
+        print_usage(prog_name);
+        error_out("--output requires --format");
+    }
+    if(wait_report_interval > 0 && wait_sample_interval == 0)
+    {
+        print_usage(prog_name);
+        error_out("--wait-events-report requires --wait-events");
+    }
+    if(output_format && !output_file)
+        report_out = stderr;
+    
+    // check the counters are available before connecting anywhere
+    if(perf_counters)
+    {
+        PerfCounters probe;
+        if(!probe.open())
+            error_out("cannot open hardware performance counters (errno=%d)", errno);
+        probe.close();
+    }
+    
+    // load the baseline upfront, not to find it invalid after the run
+    RunSummary baseline;
+    if(compare_baseline_file)
+        load_baseline(compare_baseline_file, baseline);
+
+    
+    // now parse the input into internal representation 
+    // ready to be fed to workers, and assign hosts to workers,
+    // making sure each host's data is processed by the same worker
+    
+    HostWorkerMap host_worker_map;
     
     char line[1024];
     int line_no = 1; // for CSV error location reporting
@@ -220,7 +1287,40 @@ int main(int argc, char* argv[])
         return EXIT_SUCCESS;
    }
     
+    RunSummary summary;
+    summary.input = in_file_name;
+    summary.workers = num_workers;
+    
+    // connecting upfront records what the run is against, and checks 
+    // that pg_stat_statements is usable; it's reset again at the start 
+    // of the run, after the warm-up
+    control_conn = connect_db(-1);
+    collect_environment(summary.environment);
+    if(statement_stats)
+        PQclear(control_query("SELECT pg_stat_statements_reset()"));
+    if(chunk_analysis)
+        map_chunks();
+    
+    // all timestamps from now on come from the selected clock, which
+    // is also what the noise floor is measured for
+    init_clock();
+    measure_noise_floor(summary.noise_floor);
+    
+    // workers get pointers into this array, so it must not be reallocated
     std::vector<ThreadElem> threads_array;
+    threads_array.reserve(num_workers);
+    
+    pthread_barrier_init(&sync_barrier, NULL, num_workers);
+    
+    if(trace_file)
+        start_trace_writer();
+    backend_pids.resize(num_workers);
+    if(wait_sample_interval > 0)
+        start_wait_sampler();
+    if(background_interval > 0)
+        start_background_monitor();
+    if(metrics_port)
+        start_metrics_server();
 
     for (int i = 0; i < num_workers; i++) 
     {
@@ -245,9 +1345,28 @@ int main(int argc, char* argv[])
         pthread_join(threads_array[i].thread, NULL);
     }
     
+    int64_t run_end_ns = now_ns();
+    if(wait_sample_interval > 0)
+        stop_wait_sampler();
+    if(background_interval > 0)
+        stop_background_monitor();
+    if(metrics_port)
+        stop_metrics_server();
+    StatementStatsArray statement_stats_array;
+    if(statement_stats)
+        collect_statement_stats(statement_stats_array);
+    struct rusage process_usage;
+    getrusage(RUSAGE_SELF, &process_usage);
+    summary.peak_rss_kb = process_usage.ru_maxrss;
+    clock_gettime(CLOCK_REALTIME, &summary.end_time);
+    pthread_barrier_destroy(&sync_barrier);
+    
+    if(trace_file)
+        stop_trace_writer();
+    
     // calculate the final stats
     
-    int total_queries = 0;
+    int total_queries = 0, warmup_queries = 0, passes = 0;
     double 
       total_time  = 0, 
       min_time    = DBL_MAX, 
@@ -255,35 +1374,79 @@ int main(int argc, char* argv[])
       avg_time    = 0, 
       median_time = 0;
 
-    // combines all query times from all workers, to get the median
+    // combines all query times from all workers, to get the median,
+    // and separately per iteration
     std::vector<double> all_times; 
+    std::vector<std::vector<double> > iteration_times(num_iterations);
+    std::vector<double> variant_times[2], paired_diffs;
+    
+    double max_busy_time = 0;
+    double plan_time = 0; // of all workers, in tracking the plans
+    LatencyHistogram phase_histograms[NUM_PHASES];
+    PerfCounters perf;
     
     for(int i = 0; i < num_workers; i++) 
     {
+        max_busy_time = fmax(max_busy_time, worker_output_array[i].total_time);
+        summary.client_cpu_time += worker_output_array[i].usage.cpu_ns / 1e9;
+        summary.last_finish = fmax(summary.last_finish, 
+            worker_output_array[i].finish_time);
         total_time += worker_output_array[i].total_time;
+        plan_time += worker_output_array[i].plan_time;
         total_queries += worker_output_array[i].total_queries;
+        warmup_queries += worker_output_array[i].warmup_queries;
+        passes = std::max(passes, worker_output_array[i].passes);
         min_time = fmin(min_time, worker_output_array[i].min_time);
         max_time = fmax(max_time, worker_output_array[i].max_time);
-        all_times.insert(
-            all_times.end(), 
-            worker_output_array[i].all_times.begin(), 
-            worker_output_array[i].all_times.end()
+        const QuerySampleArray &samples = worker_output_array[i].samples;
+        for(size_t j = 0; j < samples.size(); j++)
+        {
+            double time = samples[j].time_ns / 1e9;
+            all_times.push_back(time);
+            iteration_times[samples[j].iteration].push_back(time);
+            variant_times[samples[j].variant].push_back(time);
+        }
+        paired_diffs.insert(
+            paired_diffs.end(),
+            worker_output_array[i].paired_diffs.begin(),
+            worker_output_array[i].paired_diffs.end()
         );
+        for(int p = 0; p < NUM_PHASES; p++)
+            phase_histograms[p].merge(worker_output_array[i].phase_histograms[p]);
+        perf.merge(worker_output_array[i].perf);
+        for(int v = 0; v < num_variants; v++)
+        {
+            summary.histogram.merge(worker_output_array[i].variant_histograms[v]);
+            summary.variant_histograms[v].merge(
+                worker_output_array[i].variant_histograms[v]);
+        }
+    }
+    
+    if(total_queries == 0)
+    {
+        fprintf(stderr, "info: all queries were excluded as warm-up, no stats\n");
+        return EXIT_SUCCESS;
     }
+    
     avg_time = total_time / total_queries;
     
     // get the median time
     std::sort(all_times.begin(), all_times.end());
+    median_time = percentile(all_times, 50);
     
-    size_t half = all_times.size() / 2;
-    if(all_times.size() % 2) 
-        median_time = (all_times[half] + all_times[half +1]) / 2;
-    else 
-        median_time = all_times[half];
+    // throughput is taken over the measured part of the run only, 
+    // without the workers' average time in tracking the plans
+    double wall_time = (run_end_ns - run_start_ns) / 1e9;
+    double measured_time = fmax(wall_time - warmup_time - plan_time / num_workers, 0);
+    double throughput = measured_time > 0 ? total_queries / measured_time : 0;
     
-    fprintf(stdout, 
+    fprintf(report_out, 
         "Benchmark statistics (all times are in seconds with ns granularity):\n"
         "Total # of queries: %15d\n"
+        "Warm-up queries:    %15d\n"
+        "Passes over input:  %15d\n"
+        "Wall-clock time:    %15.9lf\n"
+        "Throughput (q/s):   %15.3lf\n"
         "Query execution times:\n"
         "Total:              %15.9lf\n"
         "Minimum:            %15.9lf\n"
@@ -291,6 +1454,10 @@ int main(int argc, char* argv[])
         "Average:            %15.9lf\n"
         "Median:             %15.9lf\n",
         total_queries,
+        warmup_queries,
+        passes,
+        wall_time,
+        throughput,
         total_time,
         min_time,
         max_time,
@@ -298,7 +1465,63 @@ int main(int argc, char* argv[])
         median_time
     );
     
-    return EXIT_SUCCESS;
+    print_noise_floor(summary.noise_floor);
+    print_confidence_report(all_times, iteration_times);
+    
+    if(num_variants == 2)
+        print_ab_report(variant_times, paired_diffs);
+    
+    // busy time of workers is the total time of their queries
+    summary.imbalance = max_busy_time / (total_time / num_workers);
+    if(show_breakdown)
+        compute_host_stats(summary.host_stats);
+    print_breakdown(summary);
+    
+    summary.queries = total_queries;
+    summary.wall_time = wall_time;
+    print_client_usage(summary);
+    print_net_report(summary);
+    if(statement_stats)
+        print_statement_report(statement_stats_array, summary);
+    if(wait_sample_interval > 0)
+        print_wait_report();
+    if(background_interval > 0)
+        print_background_report();
+    if(explain_file)
+        explain_slowest(explain_file);
+    if(chunk_analysis)
+        print_chunk_report();
+    if(latency_model)
+        print_latency_model();
+    if(plan_fraction > 0)
+        print_plan_report();
+    if(backend_usage)
+        print_backend_report();
+    
+    if(measure_phases)
+        print_phase_report(phase_histograms);
+    if(perf_counters)
+        print_perf_report(perf);
+    if(alloc_accounting)
+        print_alloc_report(summary.noise_floor);
+    
+    summary.warmup_queries = warmup_queries;
+    summary.passes = passes;
+    summary.start_time = run_start_wall;
+    summary.throughput = throughput;
+    
+    if(output_format)
+        write_summary(summary);
+    if(timeline_file)
+        write_timeline(timeline_file);
+    
+    int regression = 0;
+    if(compare_baseline_file)
+        regression = compare_with_baseline(compare_baseline_file, baseline, summary);
+    if(save_baseline_file)
+        save_baseline(save_baseline_file, summary);
+    
+    return regression ? exit_regression : EXIT_SUCCESS;
 }
 
 void error_out(const char * format, ...)
@@ -317,13 +1540,117 @@ void print_usage(char *prog_name)
     fprintf(stderr, 
             "Benchmark SQL queries against hypertable with sample data\n"
             "Usage: %s [-h] -n <num_workers> [-f <in_file>] [-v]\n"
+            "          [--duration <time> [--shuffle]] [--warmup-time <time>]\n"
+            "          [--warmup <num_queries>] [--iterations <num>]\n"
+            "          [--query-a <sql>] [--query-b <sql> [--ab-order <order>]]\n"
+            "          [--save-baseline <file>] [--compare-baseline <file>]\n"
+            "          [--threshold <thresholds>]\n"
+            "          [--format json|csv [--output <file>]]\n"
+            "          [--trace <file> [--trace-sample <n>]] [--breakdown]\n"
+            "          [--timeline <file>] [--phases] [--clock raw|tsc]\n"
+            "          [--perf-counters] [--alloc-stats] [--pg-stat-statements]\n"
+            "          [--wait-events <interval> [--wait-events-report <interval>]]\n"
+            "          [--explain <file> [--explain-top <k>]]\n"
+            "          [--chunks] [--latency-model] [--background <interval>]\n"
+            "          [--plans <fraction>] [--backend-usage] [--metrics-port <port>]\n"
+            "       %s --trace-dump <file>\n"
             "Arguments:\n"
             "  -h -- print this screen\n"
             "  -n -- the number of worker threads between 1 and %d\n"
             "  -f -- the input CSV file name containing the queries' parameters.\n"
             "        If omitted, standard input is assumed\n"
-            "  -v -- verbose; print some debug output\n",
-            basename(prog_name), max_num_workers
+            "  -v -- verbose; print some debug output\n"
+            "  --duration -- run for the given wall-clock time, each worker\n"
+            "        cycling through its queries until the deadline.\n"
+            "        Time is a number with optional suffix ms, s, m or h (e.g. 30m);\n"
+            "        if omitted, each worker makes a single pass over its queries\n"
+            "  --shuffle -- reshuffle each worker's queries between passes\n"
+            "  --warmup-time -- exclude queries started within the given time\n"
+            "        from the beginning of the run from stats\n"
+            "  --warmup -- the number of queries each worker runs before the\n"
+            "        measured run starts; these are excluded from stats\n"
+            "  --iterations -- repeat the measured pass (or duration) the given\n"
+            "        number of times, reporting each iteration separately\n"
+            "  --query-a -- the benchmarked query, in which {host}, {start_time}\n"
+            "        and {end_time} are replaced by values from the input;\n"
+            "        if omitted, the built-in time_bucket query is used\n"
+            "  --query-b -- A/B mode: variant of the query to compare with the\n"
+            "        above; both are run for each input row on the same\n"
+            "        connection, and their times are compared pairwise\n"
+            "  --ab-order -- which variant runs first for each row in A/B mode:\n"
+            "        alternate (default) or random\n"
+            "  --save-baseline -- save the latency histogram and throughput\n"
+            "        of this run to the given file\n"
+            "  --compare-baseline -- compare this run with the baseline saved\n"
+            "        in the given file; exit with code %d on a regression\n"
+            "  --threshold -- allowed degradation against the baseline, in\n"
+            "        percent: either a single number for all metrics or a list\n"
+            "        like p50=5,p99=10,qps=5 (the default is 5 for each); \n"
+            "        latency counts as regressed only if the difference in\n"
+            "        distributions is also statistically significant\n"
+            "  --format -- also write machine-readable summary in the given\n"
+            "        format: json or csv\n"
+            "  --output -- the file for the machine-readable summary; if omitted,\n"
+            "        it goes to standard output and the report to standard error\n"
+            "  --trace -- record a trace of the queries (worker, parameters,\n"
+            "        timestamps, rows and result size) to the given binary file\n"
+            "  --trace-sample -- trace only each n-th query of each worker\n"
+            "  --trace-dump -- print the given trace file as CSV, and exit\n"
+            "  --breakdown -- report stats per worker and per host\n"
+            "  --timeline -- write timeline of the workers' activity to the given\n"
+            "        file, in Chrome trace-event format (for Perfetto or\n"
+            "        chrome://tracing); it's kept in memory until the end of the run\n"
+            "  --phases -- send queries asynchronously, and report separately\n"
+            "        the time of sending, waiting for server's response, receiving\n"
+            "        the result and processing it\n"
+            "  --clock -- the clock to time queries with: raw (default) for\n"
+            "        CLOCK_MONOTONIC_RAW, or tsc for the CPU's time-stamp counter,\n"
+            "        calibrated against it at startup; it must be invariant\n"
+            "  --perf-counters -- count CPU cycles, instructions, cache misses\n"
+            "        and branch misses of the workers in user space, per stage of\n"
+            "        the query loop (render, send, wait, decode, stats);\n"
+            "        implies --phases\n"
+            "  --alloc-stats -- count memory allocations of the workers (including\n"
+            "        libpq's) and time spent in the allocator, per query\n"
+            "  --pg-stat-statements -- reset pg_stat_statements at the start of\n"
+            "        the run, and report server's execution and planning times and\n"
+            "        buffer usage for each query after it, with the client's\n"
+            "        overhead on top of the server's time; the extension must be\n"
+            "        installed, and the user allowed to reset it\n"
+            "  --wait-events -- sample wait events of the workers' backends from\n"
+            "        pg_stat_activity at the given interval (e.g. 10ms) on a separate\n"
+            "        connection, and report their profile for the run and for each\n"
+            "        iteration\n"
+            "  --wait-events-report -- report the wait event profile for each\n"
+            "        interval of the given length (e.g. 1m) instead of each iteration\n"
+            "  --explain -- after the run, re-run the slowest queries with EXPLAIN\n"
+            "        (ANALYZE, BUFFERS), write their plans to the given file as JSON,\n"
+            "        and report the chunks they scanned and their buffer usage\n"
+            "  --explain-top -- the number of the slowest queries to explain\n"
+            "        (default 5)\n"
+            "  --chunks -- load the chunks of cpu_usage at startup, and report\n"
+            "        latency by the number of chunks each query's time range touches,\n"
+            "        and by the number of rows it returns\n"
+            "  --latency-model -- report latency by time range length and by result\n"
+            "        rows, fit it linearly against each, and list the queries far\n"
+            "        slower than the fit against rows predicts\n"
+            "  --background -- snapshot checkpoints, vacuums, buffer writes and WAL\n"
+            "        at the given interval (e.g. 1s) on a separate connection, and\n"
+            "        report the intervals whose tail latency is high along with the\n"
+            "        background activity in them\n"
+            "  --plans -- pick the given fraction (0..1] of the input rows, follow\n"
+            "        each measured execution of them with EXPLAIN (FORMAT JSON), and\n"
+            "        report the distinct plan structures seen, with their frequency\n"
+            "        and latency; EXPLAIN runs on a separate connection of each\n"
+            "        worker, and its time is left out of the duration, throughput\n"
+            "        and client usage\n"
+            "  --backend-usage -- with the server on this host, read CPU times and\n"
+            "        I/O of the workers' backends from /proc around each query, and\n"
+            "        report them per query next to the latency\n"
+            "  --metrics-port -- serve query counters, a latency histogram, queries\n"
+            "        in flight and workers' busy ratios in Prometheus text format at\n"
+            "        http://127.0.0.1:<port>/metrics during the run\n",
+            basename(prog_name), basename(prog_name), max_num_workers, exit_regression
     );
 }
 
@@ -353,30 +1680,452 @@ void parse_query_param_line(char *line, int line_no, QueryParam &query_param)
         error_out("wrong number of fields: %d in input line %d", field_no, line_no);
 }
 
+// parses time in form of <number>[ms|s|m|h] into seconds; 
+// returns 0 if the string is not a valid non-negative time
+int parse_duration(const char *str, double &seconds)
+{
+    char *end;
+    
+    errno = 0;
+    double value = strtod(str, &end);
+    if(errno || end == str || value < 0)
+        return 0;
+    
+    if(!strcmp(end, "ms"))
+    {
+        seconds = value / 1000;
+        return 1;
+    }
+    switch(*end)
+    {
+        case '\0':
+        case 's': break;
+        case 'm': value *= 60; break;
+        case 'h': value *= 3600; break;
+        default: return 0;
+    }
+    if(*end && *(end+1))
+        return 0;
+    
+    seconds = value;
+    return 1;
+}
+
 void *worker_func(void *arg)
 {
     int worker_no = *(int*)arg;
 
-    int total_queries = 0;
-    double 
-        min_time   = DBL_MAX, 
-        max_time   = 0, 
-        total_time = 0;
-        std::vector<double> all_times;
+    int total_queries = 0, warmup_queries = 0, passes = 0;
+    int64_t 
+        min_ns   = INT64_MAX, 
+        max_ns   = 0, 
+        total_ns = 0;
+    QuerySampleArray samples;
+    TimelineEventArray timeline;
+    std::vector<double> paired_diffs;
+    LatencyHistogram variant_histograms[2];
+    LatencyHistogram phase_histograms[NUM_PHASES];
+    int rows_done = 0;
+    
+    // the worker's queries are run in this order, which may be
+    // reshuffled between passes
+    const QueryParamArray &query_params = all_query_param_arrays[worker_no];
+    std::vector<int> order(query_params.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937 rng(worker_no);
+    
+    // the rows picked for plan tracking, with a generator of their own
+    // not to change the order of the queries
+    std::vector<char> track_plans(query_params.size());
+    PlanUsageMap plans;
+    if(plan_fraction > 0)
+    {
+        std::mt19937 plan_rng(worker_no);
+        std::bernoulli_distribution pick(plan_fraction);
+        for(size_t i = 0; i < track_plans.size(); i++)
+            track_plans[i] = pick(plan_rng);
+    }
+    
+    TraceRing *trace_ring = trace_file ? trace_rings[worker_no] : NULL;
+    LiveMetrics *live = metrics_port ? live_metrics[worker_no] : NULL;
+    int trace_countdown = trace_sample;
+    ThreadUsage usage_start, usage;
+    int warmed_up = warmup_time <= 0;
+    int64_t usage_start_ns = 0;
+    AllocStats allocs_start = AllocStats(), allocs = AllocStats(), 
+        libpq_allocs = AllocStats();
+    int loop_queries = 0;
+    int64_t plan_ns = 0, iteration_plan_ns = 0; // spent in tracking plans
+    NetStats net;
+    struct tcp_info tcp_start;
+    
+    // the slowest distinct queries, the slowest first
+    SlowQueryArray slowest;
+    
+    PerfCounters perf;
+    if(perf_counters)
+    {
+        if(!perf.open())
+            error_out("cannot open hardware performance counters (errno=%d)", errno);
+        worker_perf = &perf;
+    }
 
     // establish postgres connection for this worker
-    // modify this per your setup
-    // to avoid exposing password in the code, use the ~/.pgpass file
-    // I hardcoded the info per my setup, yours is probably different
+    int64_t connect_start = now_ns();
+    PGconn *conn = connect_db(worker_no);
+    int64_t connect_end = now_ns();
+    backend_pids[worker_no] = PQbackendPID(conn);
+    BackendProc backend_proc;
+    BackendUsage backend;
+    if(backend_usage)
+        open_backend_proc(backend_pids[worker_no], worker_no, backend_proc);
+    PGconn *plan_conn = plan_fraction > 0 ? connect_db(worker_no) : NULL;
+    
+    if(timeline_file)
+    {
+        TimelineEvent event = {connect_start, connect_end, connect_end, -1, 0};
+        timeline.push_back(event);
+    }
+    
+    // warm-up phase, cycling through the worker's queries if there are
+    // fewer of them than requested
+    for(int i = 0; i < warmup_count; i++)
+    {
+        for(int variant = 0; variant < num_variants; variant++)
+        {
+            char query[2048];
+            QueryResult result;
+            int param_index = i % query_params.size();
+            render_query(query_templates[variant], 
+                query_params[param_index], query, sizeof(query));
+            const QueryParam &param = query_params[param_index];
+            DTRACE_PROBE4(pq_bench, query_start, worker_no, param.host.c_str(),
+                param.start_time.c_str(), param.end_time.c_str());
+            int64_t query_start = now_ns();
+            execute_query(conn, query, result);
+            int64_t query_end = now_ns();
+            DTRACE_PROBE3(pq_bench, query_done, worker_no, 
+                query_end - query_start, result.rows);
+            warmup_queries++;
+            
+            if(timeline_file)
+            {
+                TimelineEvent event = {
+                    query_start, result.received_ns, query_end, 
+                    param_index, variant
+                };
+                timeline.push_back(event);
+            }
+        }
+    }
+    
+    for(int iteration = 0; iteration < num_iterations; iteration++)
+    {
+        // wait for the rest of the workers to get here
+        sync_workers(iteration);
+        if(iteration == 0)
+        {
+            get_thread_usage(usage_start);
+            usage_start_ns = now_ns();
+            allocs_start = thread_allocs;
+            net.tcp = get_tcp_info(conn, tcp_start);
+        }
+        // the counts of the connection and the warm-up queries are dropped
+        if(worker_perf && iteration == 0)
+            perf.clear();
+        else if(worker_perf)
+            perf.reset();
+        iteration_plan_ns = 0;
+        
+        int deadline_reached = 0;
+
+        // traverse through all query parameters, 
+        // repeatedly if the run is time-bound
+        while(!deadline_reached)
+        {
+            if(passes > 0 && shuffle_passes)
+                std::shuffle(order.begin(), order.end(), rng);
+            passes++;
+            
+            for(int i = 0; i < order.size() && !deadline_reached; i++) 
+            {
+                const QueryParam &param = query_params[order[i]];
+                
+                // in A/B mode both variants run for the same parameters,
+                // in alternating or random order, to cancel out the effect
+                // of the one running first (warming the cache for the other)
+                int b_first = num_variants == 2 && 
+                    (ab_random_order ? rng() % 2 : rows_done % 2);
+                rows_done++;
+                
+                int64_t times[2], ends[2], phase_times[2][NUM_PHASES];
+                int rows[2];
+                int64_t row_start = 0, query_end = 0;
+                // while the warm-up time lasts, the CPU window restarts with 
+                // every row, so that it covers the measured queries only
+                if(!warmed_up)
+                {
+                    get_thread_usage(usage_start);
+                    usage_start_ns = now_ns();
+                }
+                BackendUsage backend_start, backend_end;
+                if(backend_usage)
+                    read_backend_usage(backend_proc, backend_start);
+                
+                for(int k = 0; k < num_variants; k++)
+                {
+                    int variant = b_first ? 1 - k : k;
+                    
+                    // generate the query from this workers input parameters
+                    if(worker_perf)
+                        perf.mark(STAGE_STATS);
+                    char query[2048];
+                    render_query(query_templates[variant], param, 
+                        query, sizeof(query));
+                    if(worker_perf)
+                    {
+                        perf.mark(STAGE_RENDER);
+                        perf.queries++;
+                    }
+                    if(dbg)
+                        fprintf(stderr, "debug: from wkr %d: '%s'\n", worker_no, query);
+
+                    // execute the query, measuring execution time
+                    QueryResult result;
+                    DTRACE_PROBE4(pq_bench, query_start, worker_no, 
+                        param.host.c_str(), param.start_time.c_str(), 
+                        param.end_time.c_str());
+                    AllocStats query_allocs = thread_allocs;
+                    if(live)
+                        live->in_flight.store(1, std::memory_order_relaxed);
+                    int64_t query_start = now_ns();
+                    execute_query(conn, query, result);
+                    query_end = now_ns();
+                    if(live)
+                    {
+                        live->in_flight.store(0, std::memory_order_relaxed);
+                        LiveMetrics::add(live->busy_ns, query_end - query_start);
+                    }
+                    add_alloc_stats(libpq_allocs, thread_allocs, query_allocs);
+                    loop_queries++;
+                    DTRACE_PROBE3(pq_bench, query_done, worker_no, 
+                        query_end - query_start, result.rows);
+                    
+                    // time taken by the query, in ns
+                    times[variant] = query_end - query_start;
+                    ends[variant] = query_end - run_start_ns;
+                    rows[variant] = result.rows;
+                    
+                    if(measure_phases)
+                    {
+                        int64_t *phases = phase_times[variant];
+                        phases[PHASE_SEND] = result.sent_ns - query_start;
+                        phases[PHASE_SERVER] = result.first_byte_ns - result.sent_ns;
+                        phases[PHASE_TRANSFER] = result.received_ns - result.first_byte_ns;
+                        phases[PHASE_PROCESSING] = query_end - result.received_ns;
+                    }
+                    
+                    if(trace_ring && --trace_countdown == 0)
+                    {
+                        trace_countdown = trace_sample;
+                        TraceRecord record = {
+                            query_start, 
+                            measure_phases ? result.first_byte_ns : 0, 
+                            query_end,
+                            result.bytes, (uint32_t)order[i], (uint32_t)result.rows,
+                            (uint16_t)worker_no, (uint16_t)iteration, (uint8_t)variant
+                        };
+                        trace_ring->push(record);
+                    }
+                    
+                    if(timeline_file)
+                    {
+                        TimelineEvent event = {
+                            query_start, result.received_ns, query_end, 
+                            order[i], variant
+                        };
+                        timeline.push_back(event);
+                    }
+                    
+                    if(k == 0)
+                        row_start = query_start;
+                }
+                
+                if(run_duration > 0 && query_end - iteration_start_ns - 
+                    iteration_plan_ns >= run_duration * 1e9)
+                    deadline_reached = 1;
+                
+                if(backend_usage)
+                    read_backend_usage(backend_proc, backend_end);
+                
+                // queries started within the warm-up period don't count
+                if(row_start - run_start_ns < warmup_time * 1e9)
+                {
+                    warmup_queries += num_variants;
+                    continue;
+                }
+                warmed_up = 1;
+                
+                if(backend_usage)
+                {
+                    backend.user_ticks += backend_end.user_ticks - 
+                        backend_start.user_ticks;
+                    backend.system_ticks += backend_end.system_ticks - 
+                        backend_start.system_ticks;
+                    backend.read_chars += backend_end.read_chars - 
+                        backend_start.read_chars;
+                    backend.read_bytes += backend_end.read_bytes - 
+                        backend_start.read_bytes;
+                    backend.write_bytes += backend_end.write_bytes - 
+                        backend_start.write_bytes;
+                }
+                
+                for(int variant = 0; variant < num_variants; variant++)
+                {
+                    int64_t query_ns = times[variant];
+                    total_queries++;
+                    total_ns += query_ns;
+                    min_ns = std::min(min_ns, query_ns);
+                    max_ns = std::max(max_ns, query_ns);
+                    
+                    // for median calculation on global level
+                    QuerySample sample = {
+                        query_ns, iteration, variant, order[i], rows[variant],
+                        ends[variant]
+                    };
+                    samples.push_back(sample);
+                    variant_histograms[variant].record(query_ns);
+                    if(live)
+                        live->record(variant, query_ns);
+                    
+                    if(explain_file && ((int)slowest.size() < explain_top || 
+                        query_ns > slowest.back().time_ns))
+                    {
+                        SlowQuery slow = {query_ns, worker_no, order[i], variant};
+                        add_slow_query(slowest, slow);
+                    }
+                    
+                    if(measure_phases)
+                        for(int p = 0; p < NUM_PHASES; p++)
+                            phase_histograms[p].record(phase_times[variant][p]);
+                }
+                
+                if(num_variants == 2)
+                    paired_diffs.push_back((times[1] - times[0]) / 1e9);
+                
+                // the starts of the usage and allocation windows are moved
+                // forward by what tracking the plans takes, and its time 
+                // is left out of the duration and throughput
+                if(track_plans[order[i]])
+                {
+                    if(worker_perf)
+                        perf.mark(STAGE_STATS);
+                    ThreadUsage plan_start, plan_end;
+                    get_thread_usage(plan_start);
+                    AllocStats plan_allocs = thread_allocs;
+                    int64_t plan_start_ns = now_ns();
+                    for(int variant = 0; variant < num_variants; variant++)
+                    {
+                        char query[2048];
+                        render_query(query_templates[variant], 
+                            query_params[order[i]], query, sizeof(query));
+                        track_plan(plan_conn, query, variant, ends[variant], 
+                            times[variant] / 1e9, plans);
+                    }
+                    int64_t plan_time_ns = now_ns() - plan_start_ns;
+                    plan_ns += plan_time_ns;
+                    iteration_plan_ns += plan_time_ns;
+                    get_thread_usage(plan_end);
+                    usage_start.cpu_ns += plan_end.cpu_ns - plan_start.cpu_ns;
+                    usage_start.voluntary_switches += 
+                        plan_end.voluntary_switches - plan_start.voluntary_switches;
+                    usage_start.involuntary_switches += 
+                        plan_end.involuntary_switches - plan_start.involuntary_switches;
+                    add_alloc_stats(allocs_start, thread_allocs, plan_allocs);
+                    if(worker_perf)
+                        perf.reset();
+                }
+            }
+            
+            if(run_duration == 0)
+                break;
+        }
+        
+        if(worker_perf)
+            perf.mark(STAGE_STATS);
+    }
+    
+    int64_t finish = now_ns();
+    get_thread_usage(usage);
+    usage.cpu_ns -= usage_start.cpu_ns;
+    usage.voluntary_switches -= usage_start.voluntary_switches;
+    usage.involuntary_switches -= usage_start.involuntary_switches;
+    add_alloc_stats(allocs, thread_allocs, allocs_start);
+    
+    struct tcp_info tcp_end;
+    if(net.tcp && get_tcp_info(conn, tcp_end))
+    {
+        net.bytes_sent = tcp_end.tcpi_bytes_acked - tcp_start.tcpi_bytes_acked;
+        net.bytes_received = 
+            tcp_end.tcpi_bytes_received - tcp_start.tcpi_bytes_received;
+        net.rtt_us = tcp_end.tcpi_rtt;
+        net.rtt_var_us = tcp_end.tcpi_rttvar;
+        net.retransmits = tcp_end.tcpi_total_retrans;
+        net.cwnd = tcp_end.tcpi_snd_cwnd;
+    }
+    
+    PQfinish(conn);
+    if(plan_conn)
+        PQfinish(plan_conn);
+    if(worker_perf)
+    {
+        perf.close();
+        worker_perf = NULL;
+    }
 
-    int conn_info_line_no = __LINE__ + 1;
-    const char *conn_info = "dbname=homework user=postgres password=postgres";
-    PGconn     *conn;
+    // populate the global output area -- no synchronization needed
+    worker_output_array[worker_no].total_queries  = total_queries;
+    worker_output_array[worker_no].total_time     = total_ns / 1e9;
+    worker_output_array[worker_no].min_time       = 
+        total_queries ? min_ns / 1e9 : DBL_MAX;
+    worker_output_array[worker_no].max_time       = max_ns / 1e9;
+    worker_output_array[worker_no].samples        = samples;
+    worker_output_array[worker_no].timeline.swap(timeline);
+    worker_output_array[worker_no].warmup_queries = warmup_queries;
+    worker_output_array[worker_no].passes         = passes;
+    worker_output_array[worker_no].finish_time    = (finish - run_start_ns) / 1e9;
+    worker_output_array[worker_no].usage          = usage;
+    worker_output_array[worker_no].usage_time     = 
+        (finish - usage_start_ns - plan_ns) / 1e9;
+    worker_output_array[worker_no].loop_queries   = loop_queries;
+    worker_output_array[worker_no].allocs         = allocs;
+    worker_output_array[worker_no].libpq_allocs   = libpq_allocs;
+    worker_output_array[worker_no].net            = net;
+    worker_output_array[worker_no].slowest.swap(slowest);
+    worker_output_array[worker_no].plans.swap(plans);
+    worker_output_array[worker_no].plan_time      = plan_ns / 1e9;
+    worker_output_array[worker_no].backend        = backend;
+    worker_output_array[worker_no].paired_diffs   = paired_diffs;
+    worker_output_array[worker_no].variant_histograms[0] = variant_histograms[0];
+    worker_output_array[worker_no].variant_histograms[1] = variant_histograms[1];
+    for(int p = 0; p < NUM_PHASES; p++)
+        worker_output_array[worker_no].phase_histograms[p] = phase_histograms[p];
+    worker_output_array[worker_no].perf = perf;
+    
+    return NULL;
+}
 
-    conn = PQconnectdb(conn_info);
+// connects with conn_info, exiting on failure; worker_no is -1 for 
+// the control connection
+PGconn *connect_db(int worker_no)
+{
+    DTRACE_PROBE1(pq_bench, connect_start, worker_no);
+    PGconn *conn = PQconnectdb(conn_info);
+    DTRACE_PROBE2(pq_bench, connect_done, worker_no, PQstatus(conn) == CONNECTION_OK);
 
     if (PQstatus(conn) != CONNECTION_OK) 
     {
+        DTRACE_PROBE2(pq_bench, error, PQerrorMessage(conn), conn_info);
         fprintf(stderr, 
             "error: connection to database failed, error message: %s\n",
             PQerrorMessage(conn)
@@ -388,53 +2137,7 @@ void *worker_func(void *arg)
         );
         exit_gracefully(conn);
     }
-
-    // traverse through all query parameters
-    for(int i = 0; i < all_query_param_arrays[worker_no].size(); i++) 
-    {
-        // generate the query from this workers input parameters
-        char query[2048];
-        snprintf(query, sizeof(query), 
-            "SELECT time_bucket('1 minute', ts), MIN(usage), MAX(usage) "
-            "FROM cpu_usage "
-            "WHERE host='%s' AND ts BETWEEN '%s' AND '%s' "
-            "GROUP BY 1",
-            all_query_param_arrays[worker_no][i].host.c_str(),
-            all_query_param_arrays[worker_no][i].start_time.c_str(),
-            all_query_param_arrays[worker_no][i].end_time.c_str()
-        );
-        if(dbg)
-            fprintf(stderr, "debug: from wkr %d: '%s'\n", worker_no, query);
-
-        // execute the query, measuring execution time
-        struct timespec query_start, query_end;
-        clock_gettime(CLOCK_MONOTONIC, &query_start);
-        execute_query(conn, query);
-        clock_gettime(CLOCK_MONOTONIC, &query_end);
-        
-        // query taken by the query, in seconds
-        double query_time = (
-            pow(10, 9) * query_end.tv_sec + query_end.tv_nsec - 
-            pow(10, 9) * query_start.tv_sec - query_start.tv_nsec
-        ) / pow(10, 9);
-        
-        total_queries++;
-        total_time += query_time;
-        min_time = fmin(min_time, query_time);
-        max_time = fmax(max_time, query_time);
-        
-        // for median calculation on global level
-        all_times.push_back(query_time);
-    }
-    
-    PQfinish(conn);
-
-    // populate the global output area -- no synchronization needed
-    worker_output_array[worker_no].total_queries = total_queries;
-    worker_output_array[worker_no].total_time    = total_time;
-    worker_output_array[worker_no].min_time      = min_time;
-    worker_output_array[worker_no].max_time      = max_time;
-    worker_output_array[worker_no].all_times     = all_times;
+    return conn;
 }
 
 void exit_gracefully(PGconn *conn)
@@ -443,13 +2146,20 @@ void exit_gracefully(PGconn *conn)
     exit(EXIT_FAILURE);
 }
 
-void execute_query(PGconn *conn, const char *query)
+void execute_query(PGconn *conn, const char *query, QueryResult &result)
 {
     PGresult   *res;
 
-    res = PQexec(conn, query);
+    if(measure_phases)
+        res = execute_query_phased(conn, query, result);
+    else
+    {
+        res = PQexec(conn, query);
+        result.received_ns = now_ns();
+    }
     if (PQresultStatus(res) != PGRES_TUPLES_OK)
     {
+        DTRACE_PROBE2(pq_bench, error, PQerrorMessage(conn), query);
         fprintf(stderr, 
             "error: query failed.\nError message: %s\nQuery: \"%s\"\n", 
             PQerrorMessage(conn), query
@@ -467,5 +2177,3427 @@ void execute_query(PGconn *conn, const char *query)
         );
     }
     
+    result.rows = PQntuples(res);
+    result.bytes = PQresultMemorySize(res);
+    
     PQclear(res);
-}
\ No newline at end of file
+    if(worker_perf)
+        worker_perf->mark(STAGE_DECODE);
+}
+
+// waits until the connection's socket is readable; returns 0 on error
+int wait_for_input(PGconn *conn)
+{
+    struct pollfd pfd = {PQsocket(conn), POLLIN, 0};
+    int rc;
+    while((rc = poll(&pfd, 1, -1)) < 0 && errno == EINTR)
+        ;
+    return rc > 0;
+}
+
+// sends the query asynchronously, timestamping when it's sent, when the 
+// response starts to arrive and when the result is complete; returns the 
+// result as PQexec() would, or NULL on connection failure
+PGresult *execute_query_phased(PGconn *conn, const char *query, 
+    QueryResult &result)
+{
+    // the connection is in blocking mode, so this returns once 
+    // the query is written out
+    if(!PQsendQuery(conn, query))
+        return NULL;
+    result.sent_ns = now_ns();
+    if(worker_perf)
+        worker_perf->mark(STAGE_SEND);
+    
+    if(!wait_for_input(conn))
+        return NULL;
+    result.first_byte_ns = now_ns();
+    if(worker_perf)
+        worker_perf->mark(STAGE_WAIT);
+    
+    if(!PQconsumeInput(conn))
+        return NULL;
+    while(PQisBusy(conn))
+    {
+        if(!wait_for_input(conn) || !PQconsumeInput(conn))
+            return NULL;
+    }
+    PGresult *res = PQgetResult(conn);
+    result.received_ns = now_ns();
+    
+    // the connection is ready for the next query only once all 
+    // the results (just one for our single statement) are read
+    PGresult *next;
+    while((next = PQgetResult(conn)) != NULL)
+        PQclear(next);
+    
+    return res;
+}
+
+// generates the SQL query from the template for the given input 
+// parameters; unknown placeholders are copied as is
+void render_query(const char *tmpl, const QueryParam &param, 
+    char *query, size_t size)
+{
+    static const char *names[] = {"{host}", "{start_time}", "{end_time}"};
+    const std::string *values[] = {&param.host, &param.start_time, &param.end_time};
+    
+    size_t len = 0;
+    while(*tmpl)
+    {
+        const char *value = NULL;
+        size_t value_len = 1;
+        if(*tmpl == '{')
+        {
+            for(int i = 0; i < 3; i++)
+            {
+                size_t name_len = strlen(names[i]);
+                if(!strncmp(tmpl, names[i], name_len))
+                {
+                    value = values[i]->c_str();
+                    value_len = values[i]->size();
+                    tmpl += name_len;
+                    break;
+                }
+            }
+        }
+        if(!value)
+            value = tmpl++;
+        
+        if(len + value_len >= size)
+            error_out("query is too long, exceeds %zu characters", size - 1);
+        memcpy(query + len, value, value_len);
+        len += value_len;
+    }
+    query[len] = '\0';
+}
+
+// waits for all workers to reach the start of the given iteration; 
+// the last one to arrive records its start time
+void sync_workers(int iteration)
+{
+    if(pthread_barrier_wait(&sync_barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        if(iteration == 0 && statement_stats)
+            PQclear(control_query("SELECT pg_stat_statements_reset()"));
+        iteration_start_ns = now_ns();
+        if(iteration == 0)
+        {
+            run_start_ns = iteration_start_ns;
+            clock_gettime(CLOCK_REALTIME, &run_start_wall);
+        }
+        run_iteration.store(iteration, std::memory_order_release);
+    }
+    pthread_barrier_wait(&sync_barrier);
+}
+
+// percentile (0..100) of already sorted non-empty array,
+// linearly interpolated between the closest ranks
+double percentile(const std::vector<double> &sorted, double pct)
+{
+    double rank = pct / 100 * (sorted.size() - 1);
+    size_t lower = (size_t)rank;
+    if(lower + 1 >= sorted.size())
+        return sorted.back();
+    return sorted[lower] + (rank - lower) * (sorted[lower+1] - sorted[lower]);
+}
+
+// 95% confidence interval of the given percentile of (non-empty, sorted) 
+// times: the percentile is taken over many resamples (with replacement) of 
+// the times, and the interval spans 2.5th to 97.5th percentiles of the 
+// results; beyond bootstrap_max_sample times, resamples are that size 
+// (m-out-of-n bootstrap), and their spread around the full sample's 
+// percentile is scaled down by sqrt(m/n), keeping the cost bounded
+void bootstrap_ci(const std::vector<double> &times, double pct, 
+    double &low, double &high)
+{
+    std::mt19937_64 rng(1); // fixed seed, for reproducible reports
+    std::uniform_int_distribution<size_t> pick(0, times.size() - 1);
+    std::vector<double> resample(std::min(times.size(), bootstrap_max_sample));
+    std::vector<double> estimates(bootstrap_resamples);
+    
+    double rank = pct / 100 * (resample.size() - 1);
+    size_t lower = (size_t)rank;
+    double center = percentile(times, pct);
+    double scale = sqrt((double)resample.size() / times.size());
+    
+    for(int r = 0; r < bootstrap_resamples; r++)
+    {
+        for(size_t i = 0; i < resample.size(); i++)
+            resample[i] = times[pick(rng)];
+        
+        // same interpolation as percentile(), without full sort
+        std::nth_element(resample.begin(), resample.begin() + lower, resample.end());
+        double value = resample[lower];
+        if(lower + 1 < resample.size())
+        {
+            double next = *std::min_element(resample.begin() + lower + 1, resample.end());
+            value += (rank - lower) * (next - value);
+        }
+        estimates[r] = center + (value - center) * scale;
+    }
+    
+    std::sort(estimates.begin(), estimates.end());
+    low  = percentile(estimates, 2.5);
+    high = percentile(estimates, 97.5);
+}
+
+// prints median and 99th percentile with their confidence intervals, 
+// overall and per iteration; if iteration intervals don't overlap,
+// the difference between iterations is reported as significant
+void print_confidence_report(std::vector<double> &all_times,
+    std::vector<std::vector<double> > &iteration_times)
+{
+    const double pcts[] = {50, 99};
+    const char *names[] = {"median", "p99"};
+    double low, high;
+    
+    fprintf(report_out, "Bootstrap 95%% confidence intervals:\n");
+    bootstrap_ci(all_times, 50, low, high);
+    fprintf(report_out, "Median:             %15.9lf [%.9lf, %.9lf]\n", 
+        percentile(all_times, 50), low, high);
+    bootstrap_ci(all_times, 99, low, high);
+    fprintf(report_out, "99th percentile:    %15.9lf [%.9lf, %.9lf]\n", 
+        percentile(all_times, 99), low, high);
+    
+    if(iteration_times.size() < 2)
+        return;
+    
+    // per iteration intervals, indexed by [percentile][iteration]
+    std::vector<double> lows[2], highs[2];
+    
+    fprintf(report_out, 
+        "Per-iteration results:\n"
+        "Iteration  Queries  %-40s  %s\n", 
+        "Median [95% CI]", "99th percentile [95% CI]");
+    for(size_t it = 0; it < iteration_times.size(); it++)
+    {
+        std::vector<double> &times = iteration_times[it];
+        fprintf(report_out, "%9zu %8zu", it + 1, times.size());
+        if(times.empty())
+        {
+            fprintf(report_out, "  n/a\n");
+            continue;
+        }
+        std::sort(times.begin(), times.end());
+        for(int p = 0; p < 2; p++)
+        {
+            bootstrap_ci(times, pcts[p], low, high);
+            lows[p].push_back(low);
+            highs[p].push_back(high);
+            fprintf(report_out, "  %.9lf [%.9lf, %.9lf]", 
+                percentile(times, pcts[p]), low, high);
+        }
+        fputc('\n', report_out);
+    }
+    
+    // the intervals separate iff the highest lower bound is above 
+    // the lowest upper bound
+    for(int p = 0; p < 2 && !lows[p].empty(); p++)
+    {
+        size_t max_low = std::max_element(lows[p].begin(), lows[p].end()) - lows[p].begin();
+        size_t min_high = std::min_element(highs[p].begin(), highs[p].end()) - highs[p].begin();
+        if(lows[p][max_low] > highs[p][min_high])
+            fprintf(report_out, 
+                "Iteration %s: significant change, confidence intervals "
+                "of iterations don't overlap: [%.9lf, %.9lf] vs [%.9lf, %.9lf]\n",
+                names[p], 
+                lows[p][min_high], highs[p][min_high], 
+                lows[p][max_low], highs[p][max_low]);
+        else
+            fprintf(report_out, 
+                "Iteration %s: no significant change, "
+                "confidence intervals overlap\n", names[p]);
+    }
+}
+
+static bool abs_less(double a, double b)
+{
+    return fabs(a) < fabs(b);
+}
+
+// two-sided Wilcoxon signed-rank test of paired differences, using the 
+// normal approximation with correction for ties; zero differences are 
+// dropped. Returns the p-value and the z-score in z (positive when the
+// differences tend to be positive)
+double wilcoxon_signed_rank(const std::vector<double> &diffs, double &z)
+{
+    std::vector<double> abs_diffs;
+    for(size_t i = 0; i < diffs.size(); i++)
+        if(diffs[i] != 0)
+            abs_diffs.push_back(diffs[i]);
+    
+    size_t n = abs_diffs.size();
+    z = 0;
+    if(n == 0)
+        return 1;
+    
+    // sort by absolute value, keeping the sign
+    std::sort(abs_diffs.begin(), abs_diffs.end(), abs_less);
+    
+    double w_plus = 0, tie_correction = 0;
+    for(size_t i = 0; i < n; )
+    {
+        size_t j = i;
+        while(j < n && fabs(abs_diffs[j]) == fabs(abs_diffs[i]))
+            j++;
+        double rank = (i + 1 + j) / 2.0; // average rank of the tie group
+        for(size_t k = i; k < j; k++)
+            if(abs_diffs[k] > 0)
+                w_plus += rank;
+        double t = j - i;
+        tie_correction += (t * t * t - t) / 48;
+        i = j;
+    }
+    
+    double mean = n * (n + 1) / 4.0;
+    double variance = n * (n + 1) * (2.0 * n + 1) / 24 - tie_correction;
+    if(variance <= 0)
+        return 1;
+    z = (w_plus - mean) / sqrt(variance);
+    return erfc(fabs(z) / sqrt(2));
+}
+
+// prints the comparison of variants A and B: per variant medians, 
+// the distribution of paired differences and the significance test
+void print_ab_report(std::vector<double> *variant_times, 
+    std::vector<double> &paired_diffs)
+{
+    if(paired_diffs.empty())
+        return;
+    
+    for(int v = 0; v < 2; v++)
+        std::sort(variant_times[v].begin(), variant_times[v].end());
+    
+    double mean_diff = 0;
+    int b_faster = 0;
+    for(size_t i = 0; i < paired_diffs.size(); i++)
+    {
+        mean_diff += paired_diffs[i];
+        b_faster += paired_diffs[i] < 0;
+    }
+    mean_diff /= paired_diffs.size();
+    
+    double z;
+    double p_value = wilcoxon_signed_rank(paired_diffs, z);
+    
+    std::vector<double> diffs(paired_diffs);
+    std::sort(diffs.begin(), diffs.end());
+    
+    fprintf(report_out, 
+        "A/B comparison (differences are B - A, paired by input row):\n"
+        "Pairs:              %15zu\n"
+        "Median of A:        %15.9lf\n"
+        "Median of B:        %15.9lf\n"
+        "Mean difference:    %15.9lf\n"
+        "Median difference:  %15.9lf\n"
+        "Difference p5:      %15.9lf\n"
+        "Difference p25:     %15.9lf\n"
+        "Difference p75:     %15.9lf\n"
+        "Difference p95:     %15.9lf\n"
+        "B faster (%% pairs): %15.3lf\n"
+        "Wilcoxon signed-rank test: z = %.3lf, p = %.6lf\n",
+        paired_diffs.size(),
+        percentile(variant_times[0], 50),
+        percentile(variant_times[1], 50),
+        mean_diff,
+        percentile(diffs, 50),
+        percentile(diffs, 5),
+        percentile(diffs, 25),
+        percentile(diffs, 75),
+        percentile(diffs, 95),
+        100.0 * b_faster / paired_diffs.size(),
+        z, p_value
+    );
+    
+    if(p_value < significance_level)
+        fprintf(report_out, "Result: B is significantly %s than A\n", 
+            z < 0 ? "faster" : "slower");
+    else
+        fprintf(report_out, "Result: no significant difference between A and B\n");
+}
+
+// bucket index for the value in ns: values below 2^histogram_sub_bits 
+// have buckets of their own, higher ones are bucketed by the position 
+// of their highest bit and the next histogram_sub_bits bits
+int LatencyHistogram::bucket_index(int64_t ns)
+{
+    const int64_t max_value = (INT64_C(1) << histogram_max_bits) - 1;
+    if(ns < 0)
+        ns = 0;
+    if(ns > max_value)
+        ns = max_value;
+    if(ns < (1 << histogram_sub_bits))
+        return ns;
+    
+    int shift = 63 - __builtin_clzll(ns) - histogram_sub_bits;
+    int sub_bucket = (ns >> shift) - (1 << histogram_sub_bits);
+    return ((shift + 1) << histogram_sub_bits) + sub_bucket;
+}
+
+// middle of the bucket's range, in seconds
+double LatencyHistogram::bucket_value(int index)
+{
+    int group = index >> histogram_sub_bits;
+    if(group == 0)
+        return index / pow(10, 9);
+    
+    int shift = group - 1;
+    int64_t low = (int64_t)((1 << histogram_sub_bits) + 
+        (index & ((1 << histogram_sub_bits) - 1))) << shift;
+    return (low + (INT64_C(1) << shift) / 2.0) / pow(10, 9);
+}
+
+// records time given in ns
+void LatencyHistogram::record(int64_t ns)
+{
+    double time = ns / 1e9;
+    counts[bucket_index(ns)]++;
+    total++;
+    sum += time;
+    min = fmin(min, time);
+    max = fmax(max, time);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for(int i = 0; i < histogram_num_buckets; i++)
+        counts[i] += other.counts[i];
+    total += other.total;
+    sum += other.sum;
+    min = fmin(min, other.min);
+    max = fmax(max, other.max);
+}
+
+// percentile (0..100) in seconds, taken as the value of the bucket 
+// containing the sample of that rank, clamped to the exact min and max
+// when these are known
+double LatencyHistogram::percentile(double pct) const
+{
+    if(total == 0)
+        return 0;
+    
+    uint64_t rank = (uint64_t)ceil(pct / 100 * total);
+    if(rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    int i = 0;
+    for(; i < histogram_num_buckets - 1; i++)
+    {
+        seen += counts[i];
+        if(seen >= rank)
+            break;
+    }
+    
+    double value = bucket_value(i);
+    if(max > 0)
+        value = fmin(fmax(value, min), max);
+    return value;
+}
+
+// parses either a single percentage or a list like p50=5,p99=10,qps=5
+// into regression_thresholds; returns 0 if the string is not valid
+int parse_thresholds(const char *str)
+{
+    static const char *names[NUM_METRICS] = {"p50", "p99", "qps"};
+    char *end;
+    
+    if(!strchr(str, '='))
+    {
+        double value = strtod(str, &end);
+        if(end == str || *end || value < 0)
+            return 0;
+        for(int m = 0; m < NUM_METRICS; m++)
+            regression_thresholds[m] = value;
+        return 1;
+    }
+    
+    std::string list(str);
+    char *item = strtok(&list[0], ",");
+    for(; item; item = strtok(NULL, ","))
+    {
+        char *eq = strchr(item, '=');
+        if(!eq)
+            return 0;
+        *eq = '\0';
+        
+        int m = 0;
+        while(m < NUM_METRICS && strcmp(item, names[m]))
+            m++;
+        double value = strtod(eq + 1, &end);
+        if(m == NUM_METRICS || end == eq + 1 || *end || value < 0)
+            return 0;
+        regression_thresholds[m] = value;
+    }
+    return 1;
+}
+
+// baseline file is a text file with a header, throughput data and 
+// non-empty histogram buckets, one per line
+void save_baseline(const char *file_name, const RunSummary &summary)
+{
+    FILE *file = fopen(file_name, "w");
+    if(file == NULL)
+        error_out("cannot open baseline file %s for writing (errno=%d)", 
+            file_name, errno);
+    
+    fprintf(file, 
+        "pq_bench_test baseline 2\n"
+        "histogram_sub_bits %d\n"
+        "wall_time %.9lf\n"
+        "throughput %.6lf\n",
+        histogram_sub_bits,
+        summary.wall_time,
+        summary.throughput
+    );
+    for(int i = 0; i < histogram_num_buckets; i++)
+        if(summary.histogram.counts[i])
+            fprintf(file, "bucket %d %llu\n", 
+                i, (unsigned long long)summary.histogram.counts[i]);
+    for(size_t i = 0; i < summary.environment.size(); i++)
+        fprintf(file, "env %s %s\n", summary.environment[i].first.c_str(),
+            summary.environment[i].second.c_str());
+    
+    if(fclose(file))
+        error_out("cannot write baseline file %s (errno=%d)", file_name, errno);
+}
+
+// version 1 files have no environment
+void load_baseline(const char *file_name, RunSummary &summary)
+{
+    FILE *file = fopen(file_name, "r");
+    if(file == NULL)
+        error_out("cannot open baseline file %s (errno=%d)", file_name, errno);
+    
+    char line[1024];
+    int version = 0, sub_bits = 0, line_no = 1;
+    if(!fgets(line, sizeof(line), file) || 
+        sscanf(line, "pq_bench_test baseline %d", &version) != 1 || 
+        version < 1 || version > 2)
+        error_out("%s is not a baseline file of supported version", file_name);
+    
+    while(fgets(line, sizeof(line), file))
+    {
+        int index;
+        unsigned long long count;
+        char name[64];
+        int value_start;
+        line_no++;
+        
+        if(sscanf(line, "histogram_sub_bits %d", &sub_bits) == 1)
+        {
+            if(sub_bits != histogram_sub_bits)
+                error_out("baseline %s has incompatible histogram", file_name);
+        }
+        else if(sscanf(line, "wall_time %lf", &summary.wall_time) == 1 ||
+            sscanf(line, "throughput %lf", &summary.throughput) == 1)
+            ;
+        else if(sscanf(line, "bucket %d %llu", &index, &count) == 2 &&
+            index >= 0 && index < histogram_num_buckets)
+        {
+            summary.histogram.counts[index] = count;
+            summary.histogram.total += count;
+        }
+        else if(version >= 2 && 
+            sscanf(line, "env %63s %n", name, &value_start) == 1)
+        {
+            std::string value(line + value_start);
+            value.erase(value.find_last_not_of("\r\n") + 1);
+            summary.environment.push_back(std::make_pair(name, value));
+        }
+        else
+            error_out("invalid line %d in baseline file %s", line_no, file_name);
+    }
+    fclose(file);
+    
+    if(summary.histogram.total == 0)
+        error_out("baseline file %s contains no data", file_name);
+}
+
+// two-sided Mann-Whitney U test on the histograms, samples in the same 
+// bucket being treated as ties; returns the p-value, and the z-score in
+// z (positive when values in a tend to be larger than in b)
+double mann_whitney(const LatencyHistogram &a, const LatencyHistogram &b, 
+    double &z)
+{
+    double n_a = a.total, n_b = b.total, n = n_a + n_b;
+    double u = 0, b_below = 0, tie_sum = 0;
+    
+    for(int i = 0; i < histogram_num_buckets; i++)
+    {
+        u += a.counts[i] * (b_below + 0.5 * b.counts[i]);
+        b_below += b.counts[i];
+        double t = a.counts[i] + b.counts[i];
+        tie_sum += t * t * t - t;
+    }
+    
+    double mean = n_a * n_b / 2;
+    double variance = n_a * n_b / 12 * ((n + 1) - tie_sum / (n * (n - 1)));
+    z = 0;
+    if(variance <= 0)
+        return 1;
+    z = (u - mean) / sqrt(variance);
+    return erfc(fabs(z) / sqrt(2));
+}
+
+// two-sample Kolmogorov-Smirnov test on the histograms; returns the 
+// asymptotic p-value, and the statistic (max distance between CDFs) in d
+double kolmogorov_smirnov(const LatencyHistogram &a, const LatencyHistogram &b,
+    double &d)
+{
+    double cum_a = 0, cum_b = 0;
+    d = 0;
+    for(int i = 0; i < histogram_num_buckets; i++)
+    {
+        cum_a += a.counts[i];
+        cum_b += b.counts[i];
+        d = fmax(d, fabs(cum_a / a.total - cum_b / b.total));
+    }
+    
+    double n_eff = (double)a.total * b.total / (a.total + b.total);
+    double lambda = (sqrt(n_eff) + 0.12 + 0.11 / sqrt(n_eff)) * d;
+    double p = 0;
+    for(int k = 1; k <= 100; k++)
+        p += 2 * ((k % 2) ? 1 : -1) * exp(-2.0 * k * k * lambda * lambda);
+    return fmin(fmax(p, 0), 1);
+}
+
+// prints comparison of the run with the baseline loaded from the file; 
+// returns 1 if it's a regression: significantly slower latency 
+// distribution with p50 or p99 over its threshold, or throughput 
+// dropping over its threshold
+int compare_with_baseline(const char *file_name, const RunSummary &baseline,
+    const RunSummary &current)
+{
+    static const char *names[NUM_METRICS] = {"p50", "p99", "QPS"};
+    
+    double base_values[NUM_METRICS] = {
+        baseline.histogram.percentile(50),
+        baseline.histogram.percentile(99),
+        baseline.throughput
+    };
+    double current_values[NUM_METRICS] = {
+        current.histogram.percentile(50),
+        current.histogram.percentile(99),
+        current.throughput
+    };
+    
+    double z, d;
+    double mw_p = mann_whitney(current.histogram, baseline.histogram, z);
+    double ks_p = kolmogorov_smirnov(current.histogram, baseline.histogram, d);
+    int slower = mw_p < significance_level && z > 0;
+    
+    fprintf(report_out, 
+        "Comparison with baseline %s:\n"
+        "Metric         Baseline          Current     Change  Threshold\n",
+        file_name);
+    
+    int regression = 0;
+    for(int m = 0; m < NUM_METRICS; m++)
+    {
+        double change = base_values[m] > 0 ? 
+            100 * (current_values[m] - base_values[m]) / base_values[m] : 0;
+        
+        // for throughput, the degradation is a drop
+        int over = m == METRIC_QPS ? 
+            -change > regression_thresholds[m] :
+            change > regression_thresholds[m] && slower;
+        regression |= over;
+        
+        fprintf(report_out, "%-6s %16.9lf %16.9lf %+9.2lf%% %9.2lf%%%s\n",
+            names[m], base_values[m], current_values[m], change, 
+            regression_thresholds[m], over ? "  REGRESSION" : "");
+    }
+    
+    fprintf(report_out, 
+        "Mann-Whitney U test: z = %.3lf, p = %.6lf\n"
+        "Kolmogorov-Smirnov test: D = %.6lf, p = %.6lf\n"
+        "Result: %s\n",
+        z, mw_p, d, ks_p,
+        regression ? "regression against the baseline" : 
+            slower ? "latency distribution is slower, but within thresholds" :
+            "no regression against the baseline"
+    );
+    print_environment_diff(baseline.environment, current.environment);
+    
+    return regression;
+}
+
+// ISO 8601 UTC time with ms precision
+void format_timestamp(const struct timespec &ts, char *buf, size_t size)
+{
+    struct tm tm;
+    gmtime_r(&ts.tv_sec, &tm);
+    size_t len = strftime(buf, size, "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buf + len, size - len, ".%03ldZ", ts.tv_nsec / 1000000);
+}
+
+void write_json_string(FILE *file, const char *str)
+{
+    if(str == NULL)
+    {
+        fputs("null", file);
+        return;
+    }
+    fputc('"', file);
+    for(; *str; str++)
+    {
+        if(*str == '"' || *str == '\\')
+            fprintf(file, "\\%c", *str);
+        else if((unsigned char)*str < 0x20)
+            fprintf(file, "\\u%04x", *str);
+        else
+            fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+// quoted CSV field, with the quotes in it doubled
+void write_csv_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for(; *str; str++)
+    {
+        if(*str == '"')
+            fputc('"', file);
+        fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+// count, exact totals and percentiles from the histogram, 
+// as members of JSON object
+void write_json_stats(FILE *file, const LatencyHistogram &histogram)
+{
+    fprintf(file, 
+        "\"queries\": %llu, \"total_time\": %.9lf, "
+        "\"min\": %.9lf, \"max\": %.9lf, \"avg\": %.9lf",
+        (unsigned long long)histogram.total, histogram.sum,
+        histogram.total ? histogram.min : 0, histogram.max,
+        histogram.total ? histogram.sum / histogram.total : 0);
+    for(int p = 0; p < num_summary_percentiles; p++)
+        fprintf(file, ", \"%s\": %.9lf", summary_percentile_names[p], 
+            histogram.percentile(summary_percentiles[p]));
+}
+
+// same as above, as CSV rows
+void write_csv_stats(FILE *file, const char *section, const char *entity, 
+    const LatencyHistogram &histogram)
+{
+    fprintf(file, 
+        "%s,%s,queries,%llu\n"
+        "%s,%s,total_time,%.9lf\n"
+        "%s,%s,min,%.9lf\n"
+        "%s,%s,max,%.9lf\n"
+        "%s,%s,avg,%.9lf\n",
+        section, entity, (unsigned long long)histogram.total, 
+        section, entity, histogram.sum,
+        section, entity, histogram.total ? histogram.min : 0, 
+        section, entity, histogram.max,
+        section, entity, histogram.total ? histogram.sum / histogram.total : 0);
+    for(int p = 0; p < num_summary_percentiles; p++)
+        fprintf(file, "%s,%s,%s,%.9lf\n", section, entity, 
+            summary_percentile_names[p], 
+            histogram.percentile(summary_percentiles[p]));
+}
+
+// writes machine-readable summary of the run: configuration, timing, 
+// overall stats and breakdowns per worker and per query type (variant);
+// all the percentiles come from the histograms. The CSV form is a long
+// table of section,entity,metric,value rows
+void write_summary(const RunSummary &summary)
+{
+    static const char *variant_names[] = {"A", "B"};
+    char start_time[64], end_time[64];
+    format_timestamp(summary.start_time, start_time, sizeof(start_time));
+    format_timestamp(summary.end_time, end_time, sizeof(end_time));
+    
+    FILE *file = stdout;
+    if(output_file && (file = fopen(output_file, "w")) == NULL)
+        error_out("cannot open output file %s (errno=%d)", output_file, errno);
+    
+    if(!strcmp(output_format, "json"))
+    {
+        fprintf(file, "{\n  \"config\": {\"workers\": %d, \"input\": ", 
+            summary.workers);
+        write_json_string(file, summary.input.c_str());
+        fprintf(file, 
+            ", \"duration\": %.3lf, \"shuffle\": %s, \"warmup_time\": %.3lf, "
+            "\"warmup\": %d, \"iterations\": %d, \"query_a\": ",
+            run_duration, shuffle_passes ? "true" : "false", warmup_time,
+            warmup_count, num_iterations);
+        write_json_string(file, query_templates[0]);
+        fprintf(file, ", \"query_b\": ");
+        write_json_string(file, query_templates[1]);
+        fprintf(file, ", \"ab_order\": \"%s\"},\n", 
+            ab_random_order ? "random" : "alternate");
+        
+        fprintf(file, "  \"environment\": {");
+        for(size_t i = 0; i < summary.environment.size(); i++)
+        {
+            fprintf(file, "%s", i ? ", " : "");
+            write_json_string(file, summary.environment[i].first.c_str());
+            fprintf(file, ": ");
+            write_json_string(file, summary.environment[i].second.c_str());
+        }
+        fprintf(file, "},\n");
+        
+        fprintf(file, 
+            "  \"timing\": {\"start\": \"%s\", \"end\": \"%s\", "
+            "\"wall_time\": %.9lf},\n",
+            start_time, end_time, summary.wall_time);
+        
+        const NoiseFloor &noise = summary.noise_floor;
+        fprintf(file, 
+            "  \"noise_floor\": {\"clock\": \"%s\", \"timer_overhead_ns\": %lld, "
+            "\"timer_resolution_ns\": %lld, \"max_stall_ns\": %lld, "
+            "\"stalled_pct\": %.3lf, \"wakeup_p50_ns\": %lld, "
+            "\"wakeup_p99_ns\": %lld},\n",
+            clock_source_name(), (long long)noise.timer_overhead, 
+            (long long)noise.timer_resolution, (long long)noise.max_stall,
+            noise.stalled_pct, (long long)noise.wakeup_p50, 
+            (long long)noise.wakeup_p99);
+        
+        fprintf(file, 
+            "  \"summary\": {\"warmup_queries\": %d, \"passes\": %d, "
+            "\"throughput\": %.3lf, \"imbalance\": %.3lf, "
+            "\"client_cpu_time\": %.9lf, \"peak_rss_kb\": %ld, ",
+            summary.warmup_queries, summary.passes, summary.throughput,
+            summary.imbalance, summary.client_cpu_time, summary.peak_rss_kb);
+        write_json_stats(file, summary.histogram);
+        fprintf(file, "},\n  \"workers\": [");
+        
+        for(int i = 0; i < summary.workers; i++)
+        {
+            LatencyHistogram histogram(worker_output_array[i].variant_histograms[0]);
+            histogram.merge(worker_output_array[i].variant_histograms[1]);
+            const ThreadUsage &usage = worker_output_array[i].usage;
+            fprintf(file, 
+                "%s\n    {\"worker\": %d, \"finish_time\": %.9lf, "
+                "\"idle_tail\": %.9lf, \"cpu_time\": %.9lf, "
+                "\"voluntary_switches\": %ld, \"involuntary_switches\": %ld, ", 
+                i ? "," : "", i, worker_output_array[i].finish_time,
+                summary.last_finish - worker_output_array[i].finish_time,
+                usage.cpu_ns / 1e9, usage.voluntary_switches, 
+                usage.involuntary_switches);
+            write_json_stats(file, histogram);
+            fputc('}', file);
+        }
+        fprintf(file, "\n  ],\n  \"hosts\": [");
+        
+        for(size_t h = 0; h < summary.host_stats.size(); h++)
+        {
+            const HostStats &stats = summary.host_stats[h];
+            fprintf(file, "%s\n    {\"host\": ", h ? "," : "");
+            write_json_string(file, stats.host.c_str());
+            fprintf(file, 
+                ", \"worker\": %d, \"queries\": %d, \"total_time\": %.9lf, "
+                "\"p50\": %.9lf, \"p99\": %.9lf}",
+                stats.worker, stats.queries, stats.total_time, 
+                stats.median_time, stats.p99_time);
+        }
+        fprintf(file, "\n  ],\n  \"query_types\": [");
+        
+        for(int v = 0; v < num_variants; v++)
+        {
+            fprintf(file, "%s\n    {\"type\": \"%s\", ", v ? "," : "", 
+                variant_names[v]);
+            write_json_stats(file, summary.variant_histograms[v]);
+            fputc('}', file);
+        }
+        fprintf(file, "\n  ]\n}\n");
+    }
+    else
+    {
+        fprintf(file, 
+            "section,entity,metric,value\n"
+            "config,,workers,%d\n"
+            "config,,input,",
+            summary.workers);
+        write_csv_string(file, summary.input.c_str());
+        fprintf(file, 
+            "\n"
+            "config,,duration,%.3lf\n"
+            "config,,shuffle,%d\n"
+            "config,,warmup_time,%.3lf\n"
+            "config,,warmup,%d\n"
+            "config,,iterations,%d\n"
+            "config,,ab_mode,%d\n"
+            "config,,ab_order,%s\n"
+            "timing,,start,%s\n"
+            "timing,,end,%s\n"
+            "timing,,wall_time,%.9lf\n"
+            "summary,,warmup_queries,%d\n"
+            "summary,,passes,%d\n"
+            "summary,,throughput,%.3lf\n"
+            "summary,,imbalance,%.3lf\n"
+            "summary,,client_cpu_time,%.9lf\n"
+            "summary,,peak_rss_kb,%ld\n",
+            run_duration, 
+            shuffle_passes, warmup_time, warmup_count, num_iterations, 
+            num_variants == 2, ab_random_order ? "random" : "alternate",
+            start_time, end_time, summary.wall_time,
+            summary.warmup_queries, summary.passes, summary.throughput,
+            summary.imbalance, summary.client_cpu_time, summary.peak_rss_kb);
+        write_csv_stats(file, "summary", "", summary.histogram);
+        for(size_t i = 0; i < summary.environment.size(); i++)
+        {
+            fprintf(file, "environment,,%s,", summary.environment[i].first.c_str());
+            write_csv_string(file, summary.environment[i].second.c_str());
+            fputc('\n', file);
+        }
+        
+        const NoiseFloor &noise = summary.noise_floor;
+        fprintf(file, 
+            "noise_floor,,clock,%s\n"
+            "noise_floor,,timer_overhead_ns,%lld\n"
+            "noise_floor,,timer_resolution_ns,%lld\n"
+            "noise_floor,,max_stall_ns,%lld\n"
+            "noise_floor,,stalled_pct,%.3lf\n"
+            "noise_floor,,wakeup_p50_ns,%lld\n"
+            "noise_floor,,wakeup_p99_ns,%lld\n",
+            clock_source_name(), (long long)noise.timer_overhead, 
+            (long long)noise.timer_resolution, (long long)noise.max_stall,
+            noise.stalled_pct, (long long)noise.wakeup_p50, 
+            (long long)noise.wakeup_p99);
+        
+        for(int i = 0; i < summary.workers; i++)
+        {
+            char entity[16];
+            snprintf(entity, sizeof(entity), "%d", i);
+            LatencyHistogram histogram(worker_output_array[i].variant_histograms[0]);
+            histogram.merge(worker_output_array[i].variant_histograms[1]);
+            write_csv_stats(file, "worker", entity, histogram);
+            const ThreadUsage &usage = worker_output_array[i].usage;
+            fprintf(file, 
+                "worker,%d,finish_time,%.9lf\n"
+                "worker,%d,idle_tail,%.9lf\n"
+                "worker,%d,cpu_time,%.9lf\n"
+                "worker,%d,voluntary_switches,%ld\n"
+                "worker,%d,involuntary_switches,%ld\n",
+                i, worker_output_array[i].finish_time,
+                i, summary.last_finish - worker_output_array[i].finish_time,
+                i, usage.cpu_ns / 1e9, i, usage.voluntary_switches,
+                i, usage.involuntary_switches);
+        }
+        for(size_t h = 0; h < summary.host_stats.size(); h++)
+        {
+            const HostStats &stats = summary.host_stats[h];
+            const char *host = stats.host.c_str();
+            fprintf(file, 
+                "host,%s,worker,%d\n"
+                "host,%s,queries,%d\n"
+                "host,%s,total_time,%.9lf\n"
+                "host,%s,p50,%.9lf\n"
+                "host,%s,p99,%.9lf\n",
+                host, stats.worker, host, stats.queries, 
+                host, stats.total_time, host, stats.median_time, 
+                host, stats.p99_time);
+        }
+        for(int v = 0; v < num_variants; v++)
+            write_csv_stats(file, "query_type", variant_names[v], 
+                summary.variant_histograms[v]);
+    }
+    
+    if(file != stdout && fclose(file))
+        error_out("cannot write output file %s (errno=%d)", output_file, errno);
+}
+
+// called by the ring's worker only
+void TraceRing::push(const TraceRecord &record)
+{
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if(h - cached_tail >= trace_ring_size)
+    {
+        // looks full; see how far the writer got
+        cached_tail = tail.load(std::memory_order_acquire);
+        if(h - cached_tail >= trace_ring_size)
+        {
+            dropped++;
+            return;
+        }
+    }
+    records[h & (trace_ring_size - 1)] = record;
+    head.store(h + 1, std::memory_order_release);
+}
+
+static void write_trace_string(FILE *file, const std::string &str)
+{
+    uint16_t len = str.size();
+    fwrite(&len, sizeof(len), 1, file);
+    fwrite(str.data(), 1, len, file);
+}
+
+// average time of pushing a record into a ring with room for it, the 
+// best of a few rounds filling a scratch ring, as the writer is assumed 
+// to keep up; the record is built from the timestamps taken anyway
+static double measure_trace_push()
+{
+    TraceRing *ring = new TraceRing();
+    TraceRecord record = TraceRecord();
+    double best = DBL_MAX;
+    for(int round = 0; round < 8; round++)
+    {
+        ring->head.store(0);
+        ring->tail.store(0);
+        ring->cached_tail = 0;
+        int64_t start = now_ns();
+        for(uint64_t i = 0; i < trace_ring_size; i++)
+        {
+            record.param_index = i;
+            ring->push(record);
+        }
+        best = fmin(best, (double)(now_ns() - start) / trace_ring_size);
+    }
+    delete ring;
+    return best;
+}
+
+// opens the trace file, writes its header and starts the writer thread
+void start_trace_writer()
+{
+    trace_push_ns = measure_trace_push();
+    FILE *file = fopen(trace_file, "wb");
+    if(file == NULL)
+        error_out("cannot open trace file %s for writing (errno=%d)", 
+            trace_file, errno);
+    
+    uint32_t num_workers = all_query_param_arrays.size();
+    fwrite(trace_magic, sizeof(trace_magic), 1, file);
+    fwrite(&trace_version, sizeof(trace_version), 1, file);
+    fwrite(&num_workers, sizeof(num_workers), 1, file);
+    for(uint32_t w = 0; w < num_workers; w++)
+    {
+        const QueryParamArray &params = all_query_param_arrays[w];
+        uint32_t num_params = params.size();
+        fwrite(&num_params, sizeof(num_params), 1, file);
+        for(uint32_t i = 0; i < num_params; i++)
+        {
+            write_trace_string(file, params[i].host);
+            write_trace_string(file, params[i].start_time);
+            write_trace_string(file, params[i].end_time);
+        }
+        trace_rings.push_back(new TraceRing());
+    }
+    
+    int rc = pthread_create(&trace_writer_thread, NULL, trace_writer_func, file);
+    if(rc)
+        error_out("failed to create trace writer thread, error code=%d", rc);
+}
+
+// lets the writer thread drain the rings, and waits for it to finish
+void stop_trace_writer()
+{
+    trace_stop.store(1, std::memory_order_release);
+    pthread_join(trace_writer_thread, NULL);
+    
+    uint64_t dropped = 0;
+    for(size_t w = 0; w < trace_rings.size(); w++)
+    {
+        dropped += trace_rings[w]->dropped;
+        delete trace_rings[w];
+    }
+    trace_rings.clear();
+    
+    if(dropped)
+        fprintf(stderr, "warning: %llu trace records dropped, trace writer "
+            "couldn't keep up\n", (unsigned long long)dropped);
+}
+
+// columns of a trace block
+struct TraceColumns
+{
+    std::vector<uint16_t> worker, iteration;
+    std::vector<uint8_t> variant;
+    std::vector<uint32_t> param_index, rows;
+    std::vector<int64_t> send_ns, first_byte_ns, complete_ns;
+    std::vector<uint64_t> bytes;
+};
+
+template <class T>
+static void write_trace_column(FILE *file, std::vector<T> &column)
+{
+    fwrite(column.data(), sizeof(T), column.size(), file);
+    column.clear();
+}
+
+static void write_trace_block(FILE *file, TraceColumns &columns)
+{
+    uint32_t count = columns.worker.size();
+    if(count == 0)
+        return;
+    fwrite(&trace_block_tag, sizeof(trace_block_tag), 1, file);
+    fwrite(&count, sizeof(count), 1, file);
+    write_trace_column(file, columns.worker);
+    write_trace_column(file, columns.iteration);
+    write_trace_column(file, columns.variant);
+    write_trace_column(file, columns.param_index);
+    write_trace_column(file, columns.rows);
+    write_trace_column(file, columns.send_ns);
+    write_trace_column(file, columns.first_byte_ns);
+    write_trace_column(file, columns.complete_ns);
+    write_trace_column(file, columns.bytes);
+}
+
+// drains the rings into blocks of the trace file, until stopped
+void *trace_writer_func(void *arg)
+{
+    FILE *file = (FILE*)arg;
+    TraceColumns columns;
+    int stopping = 0;
+    
+    while(1)
+    {
+        // read the flag before the last drain, so nothing pushed 
+        // before the stop is missed
+        stopping = trace_stop.load(std::memory_order_acquire);
+        
+        uint64_t drained = 0;
+        for(size_t w = 0; w < trace_rings.size(); w++)
+        {
+            TraceRing *ring = trace_rings[w];
+            uint64_t t = ring->tail.load(std::memory_order_relaxed);
+            uint64_t h = ring->head.load(std::memory_order_acquire);
+            for(; t != h; t++)
+            {
+                const TraceRecord &r = ring->records[t & (trace_ring_size - 1)];
+                columns.worker.push_back(r.worker);
+                columns.iteration.push_back(r.iteration);
+                columns.variant.push_back(r.variant);
+                columns.param_index.push_back(r.param_index);
+                columns.rows.push_back(r.rows);
+                columns.send_ns.push_back(r.send_ns);
+                columns.first_byte_ns.push_back(r.first_byte_ns);
+                columns.complete_ns.push_back(r.complete_ns);
+                columns.bytes.push_back(r.bytes);
+                if(columns.worker.size() == trace_block_records)
+                    write_trace_block(file, columns);
+                drained++;
+            }
+            ring->tail.store(h, std::memory_order_release);
+        }
+        
+        if(stopping)
+            break;
+        if(!drained)
+        {
+            struct timespec pause = {0, 1000000}; // 1 ms
+            nanosleep(&pause, NULL);
+        }
+    }
+    
+    write_trace_block(file, columns);
+    fwrite(&trace_end_tag, sizeof(trace_end_tag), 1, file);
+    if(fclose(file))
+        fprintf(stderr, "error: cannot write trace file %s (errno=%d)\n", 
+            trace_file, errno);
+    return NULL;
+}
+
+static void read_trace(void *buf, size_t size, size_t count, FILE *file, 
+    const char *file_name)
+{
+    if(fread(buf, size, count, file) != count)
+        error_out("trace file %s is truncated or corrupt", file_name);
+}
+
+template <class T>
+static void read_trace_column(std::vector<T> &column, uint32_t count, 
+    FILE *file, const char *file_name)
+{
+    column.resize(count);
+    read_trace(column.data(), sizeof(T), count, file, file_name);
+}
+
+// prints the trace as CSV to standard output
+void dump_trace(const char *file_name)
+{
+    FILE *file = fopen(file_name, "rb");
+    if(file == NULL)
+        error_out("cannot open trace file %s (errno=%d)", file_name, errno);
+    
+    char magic[sizeof(trace_magic)];
+    uint32_t version, num_workers;
+    read_trace(magic, sizeof(magic), 1, file, file_name);
+    read_trace(&version, sizeof(version), 1, file, file_name);
+    if(memcmp(magic, trace_magic, sizeof(magic)) || version != trace_version)
+        error_out("%s is not a trace file of supported version", file_name);
+    
+    read_trace(&num_workers, sizeof(num_workers), 1, file, file_name);
+    AllQueryParamArrays params(num_workers);
+    for(uint32_t w = 0; w < num_workers; w++)
+    {
+        uint32_t num_params;
+        read_trace(&num_params, sizeof(num_params), 1, file, file_name);
+        params[w].resize(num_params);
+        for(uint32_t i = 0; i < num_params; i++)
+        {
+            std::string *fields[] = {
+                &params[w][i].host, &params[w][i].start_time, &params[w][i].end_time
+            };
+            for(int f = 0; f < 3; f++)
+            {
+                uint16_t len;
+                read_trace(&len, sizeof(len), 1, file, file_name);
+                fields[f]->resize(len);
+                read_trace(&(*fields[f])[0], 1, len, file, file_name);
+            }
+        }
+    }
+    
+    fprintf(stdout, "worker,iteration,variant,host,start_time,end_time,"
+        "send_ns,first_byte_ns,complete_ns,latency_ns,rows,bytes\n");
+    
+    TraceColumns columns;
+    uint32_t tag, count;
+    while(1)
+    {
+        read_trace(&tag, sizeof(tag), 1, file, file_name);
+        if(tag == trace_end_tag)
+            break;
+        if(tag != trace_block_tag)
+            error_out("trace file %s is corrupt", file_name);
+        
+        read_trace(&count, sizeof(count), 1, file, file_name);
+        read_trace_column(columns.worker, count, file, file_name);
+        read_trace_column(columns.iteration, count, file, file_name);
+        read_trace_column(columns.variant, count, file, file_name);
+        read_trace_column(columns.param_index, count, file, file_name);
+        read_trace_column(columns.rows, count, file, file_name);
+        read_trace_column(columns.send_ns, count, file, file_name);
+        read_trace_column(columns.first_byte_ns, count, file, file_name);
+        read_trace_column(columns.complete_ns, count, file, file_name);
+        read_trace_column(columns.bytes, count, file, file_name);
+        
+        for(uint32_t i = 0; i < count; i++)
+        {
+            uint16_t w = columns.worker[i];
+            uint32_t p = columns.param_index[i];
+            if(w >= num_workers || p >= params[w].size())
+                error_out("trace file %s is corrupt", file_name);
+            fprintf(stdout, "%u,%u,%c,%s,%s,%s,%lld,%lld,%lld,%lld,%u,%llu\n",
+                w, columns.iteration[i], "AB"[columns.variant[i] & 1],
+                params[w][p].host.c_str(), 
+                params[w][p].start_time.c_str(), 
+                params[w][p].end_time.c_str(),
+                (long long)columns.send_ns[i], 
+                (long long)columns.first_byte_ns[i],
+                (long long)columns.complete_ns[i],
+                (long long)(columns.complete_ns[i] - columns.send_ns[i]),
+                columns.rows[i], 
+                (unsigned long long)columns.bytes[i]);
+        }
+    }
+    fclose(file);
+}
+
+// groups the measured times by host; as each host is assigned to
+// a single worker, it's enough to group each worker's samples
+void compute_host_stats(HostStatsArray &host_stats)
+{
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const QueryParamArray &params = all_query_param_arrays[w];
+        const QuerySampleArray &samples = worker_output_array[w].samples;
+        std::map<std::string, std::vector<double> > host_times;
+        
+        for(size_t i = 0; i < samples.size(); i++)
+            host_times[params[samples[i].param_index].host].push_back(samples[i].time_ns / 1e9);
+        
+        std::map<std::string, std::vector<double> >::iterator iter;
+        for(iter = host_times.begin(); iter != host_times.end(); ++iter)
+        {
+            std::vector<double> &times = iter->second;
+            std::sort(times.begin(), times.end());
+            HostStats stats = {
+                iter->first, (int)w, (int)times.size(),
+                std::accumulate(times.begin(), times.end(), 0.0),
+                percentile(times, 50), percentile(times, 99)
+            };
+            host_stats.push_back(stats);
+        }
+    }
+}
+
+// prints the imbalance factor, and if asked for, the stats per worker
+// (busy time, finish time and how long it idled waiting for the last one 
+// to finish) and per host
+void print_breakdown(const RunSummary &summary)
+{
+    fprintf(report_out, 
+        "Worker imbalance (max/mean busy time): %.3lf\n", summary.imbalance);
+    if(!show_breakdown)
+        return;
+    
+    fprintf(report_out, 
+        "Per-worker breakdown (times since the start of the run):\n"
+        "Worker    Hosts    Queries        Busy time      Finish time        Idle tail\n");
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const WorkerOutput &output = worker_output_array[w];
+        int hosts = 0;
+        for(size_t h = 0; h < summary.host_stats.size(); h++)
+            hosts += summary.host_stats[h].worker == (int)w;
+        fprintf(report_out, "%6zu %8d %10.0lf %16.9lf %16.9lf %16.9lf\n",
+            w, hosts, output.total_queries, output.total_time, 
+            output.finish_time, summary.last_finish - output.finish_time);
+    }
+    
+    fprintf(report_out, 
+        "Per-host breakdown:\n"
+        "%-24s Worker    Queries       Total time           Median  99th percentile\n",
+        "Host");
+    for(size_t h = 0; h < summary.host_stats.size(); h++)
+    {
+        const HostStats &stats = summary.host_stats[h];
+        fprintf(report_out, "%-24s %6d %10d %16.9lf %16.9lf %16.9lf\n",
+            stats.host.c_str(), stats.worker, stats.queries, stats.total_time,
+            stats.median_time, stats.p99_time);
+    }
+}
+
+// Chrome trace-event timestamp: in us, relative to the origin
+static void write_timeline_ts(FILE *file, const char *name, int64_t ns, 
+    int64_t origin_ns)
+{
+    fprintf(file, "\"%s\": %.3lf", name, (ns - origin_ns) / 1000.0);
+}
+
+static void write_timeline_span(FILE *file, const char *name, int tid, 
+    int64_t start_ns, int64_t end_ns, int64_t origin_ns)
+{
+    fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+        "\"tid\": %d, ", name, tid);
+    write_timeline_ts(file, "ts", start_ns, origin_ns);
+    fprintf(file, ", ");
+    write_timeline_ts(file, "dur", end_ns, start_ns);
+}
+
+// writes the workers' timelines as Chrome trace events: a track per 
+// worker with spans for connection, queries (with their parameters) and 
+// result processing, plus a counter of the queries in flight, which is 
+// derived from the spans here rather than tracked during the run
+void write_timeline(const char *file_name)
+{
+    FILE *file = fopen(file_name, "w");
+    if(file == NULL)
+        error_out("cannot open timeline file %s (errno=%d)", file_name, errno);
+    
+    // the origin is the first connection attempt
+    int64_t origin_ns = INT64_MAX;
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+        if(!worker_output_array[w].timeline.empty())
+            origin_ns = std::min(origin_ns, 
+                worker_output_array[w].timeline[0].start_ns);
+    
+    // +1 when a query is sent, -1 when its result is received
+    std::vector<std::pair<int64_t, int> > in_flight_changes;
+    
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n"
+        "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+        "\"args\": {\"name\": \"pq_bench_test\"}}");
+    
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const TimelineEventArray &timeline = worker_output_array[w].timeline;
+        const QueryParamArray &params = all_query_param_arrays[w];
+        
+        fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", "
+            "\"pid\": 1, \"tid\": %zu, \"args\": {\"name\": \"worker %zu\"}}", 
+            w, w);
+        
+        for(size_t i = 0; i < timeline.size(); i++)
+        {
+            const TimelineEvent &event = timeline[i];
+            if(event.param_index < 0)
+            {
+                write_timeline_span(file, "connect", w, 
+                    event.start_ns, event.end_ns, origin_ns);
+                fprintf(file, "}");
+                continue;
+            }
+            
+            const QueryParam &param = params[event.param_index];
+            write_timeline_span(file, "query", w, 
+                event.start_ns, event.result_ns, origin_ns);
+            fprintf(file, ", \"args\": {\"variant\": \"%c\", \"host\": ", 
+                "AB"[event.variant]);
+            write_json_string(file, param.host.c_str());
+            fprintf(file, ", \"start_time\": ");
+            write_json_string(file, param.start_time.c_str());
+            fprintf(file, ", \"end_time\": ");
+            write_json_string(file, param.end_time.c_str());
+            fprintf(file, "}}");
+            
+            write_timeline_span(file, "result", w, 
+                event.result_ns, event.end_ns, origin_ns);
+            fprintf(file, "}");
+            
+            in_flight_changes.push_back(std::make_pair(event.start_ns, 1));
+            in_flight_changes.push_back(std::make_pair(event.result_ns, -1));
+        }
+    }
+    
+    // at equal times, the decrements sort first
+    std::sort(in_flight_changes.begin(), in_flight_changes.end());
+    int in_flight = 0;
+    for(size_t i = 0; i < in_flight_changes.size(); i++)
+    {
+        in_flight += in_flight_changes[i].second;
+        if(i + 1 < in_flight_changes.size() && 
+            in_flight_changes[i + 1].first == in_flight_changes[i].first)
+            continue;
+        fprintf(file, ",\n{\"name\": \"in_flight\", \"ph\": \"C\", "
+            "\"pid\": 1, ");
+        write_timeline_ts(file, "ts", in_flight_changes[i].first, origin_ns);
+        fprintf(file, ", \"args\": {\"queries\": %d}}", in_flight);
+    }
+    
+    fprintf(file, "\n]}\n");
+    if(fclose(file))
+        error_out("cannot write timeline file %s (errno=%d)", file_name, errno);
+}
+
+// prints distribution of each phase's time, and its share of the total
+void print_phase_report(const LatencyHistogram *phase_histograms)
+{
+    double total = 0;
+    for(int p = 0; p < NUM_PHASES; p++)
+        total += phase_histograms[p].sum;
+    
+    fprintf(report_out, 
+        "Query phases:\n"
+        "Phase               Average           Median              p90"
+        "              p99          Maximum   Share\n");
+    for(int p = 0; p < NUM_PHASES; p++)
+    {
+        const LatencyHistogram &histogram = phase_histograms[p];
+        if(histogram.total == 0)
+            continue;
+        fprintf(report_out, "%-10s %16.9lf %16.9lf %16.9lf %16.9lf %16.9lf %6.1lf%%\n",
+            phase_names[p],
+            histogram.sum / histogram.total,
+            histogram.percentile(50),
+            histogram.percentile(90),
+            histogram.percentile(99),
+            histogram.max,
+            total > 0 ? 100 * histogram.sum / total : 0);
+    }
+}
+
+// current time of the selected clock, in ns
+int64_t now_ns()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if(clock_source == CLOCK_SOURCE_TSC)
+    {
+        unsigned int aux;
+        uint64_t ticks = __rdtscp(&aux) - tsc_base;
+        return tsc_base_ns + (int64_t)(((unsigned __int128)ticks * tsc_mult) >> 32);
+    }
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// if TSC is requested, checks that it's invariant (ticks at constant
+// rate regardless of power states), and calibrates it against 
+// CLOCK_MONOTONIC_RAW; falls back to the latter otherwise
+void init_clock()
+{
+    if(clock_source != CLOCK_SOURCE_TSC)
+        return;
+    clock_source = CLOCK_SOURCE_RAW;
+    
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if(__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8)))
+    {
+        unsigned int aux;
+        int64_t start_ns = now_ns();
+        uint64_t start_ticks = __rdtscp(&aux);
+        struct timespec pause = {0, tsc_calibration_ns};
+        nanosleep(&pause, NULL);
+        int64_t end_ns = now_ns();
+        uint64_t end_ticks = __rdtscp(&aux);
+        
+        tsc_mult = (uint64_t)(((unsigned __int128)(end_ns - start_ns) << 32) / 
+            (end_ticks - start_ticks));
+        tsc_base = end_ticks;
+        tsc_base_ns = end_ns;
+        clock_source = CLOCK_SOURCE_TSC;
+        return;
+    }
+#endif
+    fprintf(stderr, "warning: no invariant TSC, using CLOCK_MONOTONIC_RAW\n");
+}
+
+const char *clock_source_name()
+{
+    return clock_source == CLOCK_SOURCE_TSC ? "tsc" : "raw";
+}
+
+// measures what the client adds to every measurement, regardless of 
+// the server: with sub-millisecond queries it's a sizable part of them
+void measure_noise_floor(NoiseFloor &noise)
+{
+    // back-to-back readings: the median gap is the cost of a reading,
+    // and the smallest non-zero one is the resolution
+    std::vector<int64_t> gaps(noise_readings);
+    int64_t prev = now_ns();
+    for(int i = 0; i < noise_readings; i++)
+    {
+        int64_t now = now_ns();
+        gaps[i] = now - prev;
+        prev = now;
+    }
+    std::sort(gaps.begin(), gaps.end());
+    noise.timer_overhead = gaps[noise_readings / 2];
+    std::vector<int64_t>::iterator nonzero = 
+        std::upper_bound(gaps.begin(), gaps.end(), 0);
+    noise.timer_resolution = nonzero != gaps.end() ? *nonzero : 0;
+    
+    // spinning on the clock, the thread only sees long gaps when 
+    // it's not running
+    int64_t start = now_ns(), stalled = 0;
+    prev = start;
+    while(prev - start < noise_spin_ns)
+    {
+        int64_t now = now_ns();
+        if(now - prev > noise_stall_ns)
+            stalled += now - prev;
+        noise.max_stall = std::max(noise.max_stall, now - prev);
+        prev = now;
+    }
+    noise.stalled_pct = 100.0 * stalled / (prev - start);
+    
+    // waking up from a short sleep is what waiting for a response costs
+    std::vector<int64_t> delays(noise_sleeps);
+    for(int i = 0; i < noise_sleeps; i++)
+    {
+        struct timespec pause = {0, noise_sleep_ns};
+        int64_t before = now_ns();
+        nanosleep(&pause, NULL);
+        delays[i] = now_ns() - before - noise_sleep_ns;
+    }
+    std::sort(delays.begin(), delays.end());
+    noise.wakeup_p50 = delays[noise_sleeps / 2];
+    noise.wakeup_p99 = delays[noise_sleeps * 99 / 100];
+}
+
+void print_noise_floor(const NoiseFloor &noise)
+{
+    char clock[32];
+    if(clock_source == CLOCK_SOURCE_TSC)
+        snprintf(clock, sizeof(clock), "tsc %.3lf GHz", 
+            (double)((uint64_t)1 << 32) / tsc_mult);
+    else
+        snprintf(clock, sizeof(clock), "raw");
+    
+    fprintf(report_out, 
+        "Noise floor of the client (in ns):\n"
+        "Clock:              %15s\n"
+        "Timer overhead:     %15lld\n"
+        "Timer resolution:   %15lld\n"
+        "Max stall:          %15lld\n"
+        "Stalled time (%%):   %15.3lf\n"
+        "Wake-up delay p50:  %15lld\n"
+        "Wake-up delay p99:  %15lld\n",
+        clock,
+        (long long)noise.timer_overhead,
+        (long long)noise.timer_resolution,
+        (long long)noise.max_stall,
+        noise.stalled_pct,
+        (long long)noise.wakeup_p50,
+        (long long)noise.wakeup_p99
+    );
+    if(trace_file)
+        fprintf(report_out, "Trace record push:  %15.1lf\n", trace_push_ns);
+}
+
+// CPU time and context switches of the calling thread so far
+void get_thread_usage(ThreadUsage &usage)
+{
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    usage.cpu_ns = (int64_t)cpu.tv_sec * 1000000000 + cpu.tv_nsec;
+    
+    struct rusage thread_usage;
+    getrusage(RUSAGE_THREAD, &thread_usage);
+    usage.voluntary_switches = thread_usage.ru_nvcsw;
+    usage.involuntary_switches = thread_usage.ru_nivcsw;
+}
+
+// resources used by the client itself, warning about workers busy 
+// enough on CPU to limit the throughput on their own
+void print_client_usage(const RunSummary &summary)
+{
+    long voluntary_switches = 0, involuntary_switches = 0;
+    double max_utilization = 0;
+    int busiest = 0;
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const WorkerOutput &output = worker_output_array[w];
+        voluntary_switches += output.usage.voluntary_switches;
+        involuntary_switches += output.usage.involuntary_switches;
+        double utilization = output.usage_time > 0 ? 
+            100 * output.usage.cpu_ns / 1e9 / output.usage_time : 0;
+        if(utilization > max_utilization)
+        {
+            max_utilization = utilization;
+            busiest = w;
+        }
+    }
+    
+    fprintf(report_out, 
+        "Client resources (CPU times are in seconds):\n"
+        "CPU time:           %15.9lf\n"
+        "CPU per query:      %15.9lf\n"
+        "Voluntary switches: %15ld\n"
+        "Forced switches:    %15ld\n"
+        "Peak RSS (KiB):     %15ld\n"
+        "Max worker CPU (%%): %15.1lf\n",
+        summary.client_cpu_time,
+        summary.queries ? summary.client_cpu_time / summary.queries : 0,
+        voluntary_switches,
+        involuntary_switches,
+        summary.peak_rss_kb,
+        max_utilization
+    );
+    
+    if(max_utilization > client_busy_warn_pct)
+        fprintf(stderr, 
+            "warning: worker %d was on CPU for %.0lf%% of the run, "
+            "the results may reflect the client rather than the server\n",
+            busiest, max_utilization);
+}
+
+// opens the counters as a group, so that they're all scheduled on 
+// the PMU together; returns 0 on failure, with errno set
+int PerfCounters::open()
+{
+    static const uint64_t configs[NUM_PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, 
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, 
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+    
+    for(int c = 0; c < NUM_PERF_COUNTERS; c++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[c];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = c == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        
+        fds[c] = syscall(__NR_perf_event_open, &attr, 0, -1, fds[0], 0);
+        if(fds[c] < 0)
+        {
+            int saved_errno = errno;
+            close();
+            errno = saved_errno;
+            return 0;
+        }
+    }
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    reset();
+    return 1;
+}
+
+void PerfCounters::close()
+{
+    for(int c = 0; c < NUM_PERF_COUNTERS; c++)
+    {
+        if(fds[c] >= 0)
+            ::close(fds[c]);
+        fds[c] = -1;
+    }
+}
+
+// starts counting from now, dropping the events since the last mark
+void PerfCounters::reset()
+{
+    uint64_t values[1 + NUM_PERF_COUNTERS];
+    if(read(fds[0], values, sizeof(values)) == sizeof(values))
+        memcpy(last, values + 1, sizeof(last));
+}
+
+// starts counting from now, dropping the counts so far
+void PerfCounters::clear()
+{
+    memset(counts, 0, sizeof(counts));
+    reset();
+}
+
+void PerfCounters::mark(int stage)
+{
+    // the group is read as the number of counters, then their values
+    uint64_t values[1 + NUM_PERF_COUNTERS];
+    if(read(fds[0], values, sizeof(values)) != sizeof(values))
+        return;
+    for(int c = 0; c < NUM_PERF_COUNTERS; c++)
+    {
+        counts[stage][c] += values[1 + c] - last[c];
+        last[c] = values[1 + c];
+    }
+}
+
+void PerfCounters::merge(const PerfCounters &other)
+{
+    for(int i = 0; i < NUM_STAGES; i++)
+        for(int c = 0; c < NUM_PERF_COUNTERS; c++)
+            counts[i][c] += other.counts[i][c];
+    queries += other.queries;
+}
+
+// prints the counts per query for each stage of the loop, with IPC
+void print_perf_report(const PerfCounters &perf)
+{
+    if(perf.queries == 0)
+        return;
+    
+    uint64_t totals[NUM_PERF_COUNTERS] = {0};
+    fprintf(report_out, 
+        "Client hardware counters per query (user space):\n"
+        "Stage            Cycles     Instructions      IPC     Cache misses    Branch misses\n");
+    for(int i = 0; i <= NUM_STAGES; i++)
+    {
+        const uint64_t *counts = i < NUM_STAGES ? perf.counts[i] : totals;
+        if(i < NUM_STAGES)
+            for(int c = 0; c < NUM_PERF_COUNTERS; c++)
+                totals[c] += counts[c];
+        fprintf(report_out, "%-10s %12.0lf %16.0lf %8.2lf %16.1lf %16.1lf\n",
+            i < NUM_STAGES ? stage_names[i] : "total",
+            (double)counts[PERF_CYCLES] / perf.queries,
+            (double)counts[PERF_INSTRUCTIONS] / perf.queries,
+            counts[PERF_CYCLES] ? 
+                (double)counts[PERF_INSTRUCTIONS] / counts[PERF_CYCLES] : 0,
+            (double)counts[PERF_CACHE_MISSES] / perf.queries,
+            (double)counts[PERF_BRANCH_MISSES] / perf.queries);
+    }
+}
+
+// adds the allocations between two snapshots of thread_allocs
+void add_alloc_stats(AllocStats &sum, const AllocStats &end, 
+    const AllocStats &start)
+{
+    sum.allocs += end.allocs - start.allocs;
+    sum.frees += end.frees - start.frees;
+    sum.bytes += end.bytes - start.bytes;
+    sum.ns += end.ns - start.ns;
+}
+
+static void print_alloc_row(const char *name, const AllocStats &stats,
+    int queries)
+{
+    fprintf(report_out, "%-10s %16.1lf %16.1lf %16.1lf %16.1lf\n",
+        name,
+        (double)stats.allocs / queries,
+        (double)stats.frees / queries,
+        (double)stats.bytes / queries,
+        (double)stats.ns / queries);
+}
+
+// prints allocations per query, split to those made while executing 
+// the queries (mostly libpq's) and the rest, with the share of the 
+// workers' CPU time spent in the allocator; the time of each call is 
+// measured with the clock, so its overhead (as in the noise floor) is 
+// subtracted
+void print_alloc_report(const NoiseFloor &noise)
+{
+    AllocStats total = AllocStats(), libpq = AllocStats();
+    int queries = 0;
+    double cpu_time = 0;
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const WorkerOutput &output = worker_output_array[w];
+        add_alloc_stats(total, output.allocs, AllocStats());
+        add_alloc_stats(libpq, output.libpq_allocs, AllocStats());
+        queries += output.loop_queries;
+        cpu_time += output.usage.cpu_ns / 1e9;
+    }
+    if(queries == 0)
+        return;
+    
+    AllocStats other = AllocStats();
+    add_alloc_stats(other, total, libpq);
+    
+    fprintf(report_out, 
+        "Client allocations per query:\n"
+        "Part          Allocations            Frees            Bytes        Time (ns)\n");
+    print_alloc_row("queries", libpq, queries);
+    print_alloc_row("other", other, queries);
+    print_alloc_row("total", total, queries);
+    
+    double alloc_time = 
+        (total.ns - (double)(total.allocs + total.frees) * noise.timer_overhead) / 1e9;
+    fprintf(report_out, "Allocator share of worker CPU time: %.1lf%%\n",
+        cpu_time > 0 ? 100 * fmax(alloc_time, 0) / cpu_time : 0);
+    
+    if(!show_breakdown)
+        return;
+    fprintf(report_out, 
+        "Worker        Allocations            Frees            Bytes        Time (ns)\n");
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const WorkerOutput &output = worker_output_array[w];
+        if(output.loop_queries == 0)
+            continue;
+        char name[24];
+        snprintf(name, sizeof(name), "%zu", w);
+        print_alloc_row(name, output.allocs, output.loop_queries);
+    }
+}
+
+// the allocator interposed for the whole process, libpq included: 
+// it calls glibc's own implementation, counting the calls of each 
+// thread if asked to
+extern "C" 
+{
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) __THROW
+{
+    if(!alloc_accounting)
+        return __libc_malloc(size);
+    int64_t start = now_ns();
+    void *ptr = __libc_malloc(size);
+    thread_allocs.ns += now_ns() - start;
+    thread_allocs.allocs++;
+    thread_allocs.bytes += size;
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size) __THROW
+{
+    if(!alloc_accounting)
+        return __libc_calloc(count, size);
+    int64_t start = now_ns();
+    void *ptr = __libc_calloc(count, size);
+    thread_allocs.ns += now_ns() - start;
+    thread_allocs.allocs++;
+    thread_allocs.bytes += count * size;
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) __THROW
+{
+    if(!alloc_accounting)
+        return __libc_realloc(ptr, size);
+    int64_t start = now_ns();
+    void *new_ptr = __libc_realloc(ptr, size);
+    thread_allocs.ns += now_ns() - start;
+    thread_allocs.allocs++;
+    thread_allocs.bytes += size;
+    return new_ptr;
+}
+
+void free(void *ptr) __THROW
+{
+    if(!alloc_accounting || ptr == NULL)
+    {
+        __libc_free(ptr);
+        return;
+    }
+    int64_t start = now_ns();
+    __libc_free(ptr);
+    thread_allocs.ns += now_ns() - start;
+    thread_allocs.frees++;
+}
+}
+
+// returns 0 if the connection isn't TCP (e.g. a Unix-domain socket)
+int get_tcp_info(PGconn *conn, struct tcp_info &info)
+{
+    socklen_t len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+    return getsockopt(PQsocket(conn), IPPROTO_TCP, TCP_INFO, &info, &len) == 0;
+}
+
+// traffic per query and its rate over the run, for TCP connections;
+// with the breakdown, also the state of each connection
+void print_net_report(const RunSummary &summary)
+{
+    uint64_t bytes_sent = 0, bytes_received = 0;
+    int queries = 0, connections = 0;
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const WorkerOutput &output = worker_output_array[w];
+        if(!output.net.tcp)
+            continue;
+        connections++;
+        bytes_sent += output.net.bytes_sent;
+        bytes_received += output.net.bytes_received;
+        queries += output.loop_queries;
+    }
+    if(connections == 0 || queries == 0 || summary.wall_time <= 0)
+        return;
+    
+    fprintf(report_out, 
+        "Network traffic (TCP):\n"
+        "Sent/query (bytes): %15.1lf\n"
+        "Recv/query (bytes): %15.1lf\n"
+        "Sent (MB/s):        %15.3lf\n"
+        "Received (MB/s):    %15.3lf\n",
+        (double)bytes_sent / queries,
+        (double)bytes_received / queries,
+        bytes_sent / summary.wall_time / 1e6,
+        bytes_received / summary.wall_time / 1e6
+    );
+    
+    if(!show_breakdown)
+        return;
+    fprintf(report_out, 
+        "Worker       Bytes sent   Bytes received   RTT (us)   RTT var (us)"
+        "   Retransmits   Cwnd\n");
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const NetStats &net = worker_output_array[w].net;
+        if(!net.tcp)
+            continue;
+        fprintf(report_out, "%6zu %16llu %16llu %10u %14u %13u %6u\n",
+            w, (unsigned long long)net.bytes_sent, 
+            (unsigned long long)net.bytes_received, net.rtt_us, 
+            net.rtt_var_us, net.retransmits, net.cwnd);
+    }
+}
+
+// runs the query on the control connection, exiting on failure; 
+// the result is to be freed by the caller
+PGresult *control_query(const char *sql)
+{
+    PGresult *res = PQexec(control_conn, sql);
+    if(PQresultStatus(res) != PGRES_TUPLES_OK && 
+        PQresultStatus(res) != PGRES_COMMAND_OK)
+    {
+        fprintf(stderr, 
+            "error: control query failed.\nError message: %s\nQuery: \"%s\"\n", 
+            PQerrorMessage(control_conn), sql
+        );
+        PQclear(res);
+        exit_gracefully(control_conn);
+    }
+    return res;
+}
+
+// snapshot of pg_stat_statements for the statements of this database 
+// and user, except those querying pg_stat_statements itself
+void collect_statement_stats(StatementStatsArray &stats)
+{
+    // columns were renamed in 13, when planning time was added
+    int v13 = PQserverVersion(control_conn) >= 130000;
+    char sql[1024];
+    snprintf(sql, sizeof(sql), 
+        "SELECT query, calls, %s, %s, %s, shared_blks_hit, shared_blks_read "
+        "FROM pg_stat_statements "
+        "WHERE dbid = (SELECT oid FROM pg_database WHERE datname = current_database()) "
+        "AND userid = (SELECT oid FROM pg_roles WHERE rolname = current_user) "
+        "AND calls > 0 AND query NOT LIKE '%%pg_stat_statements%%' "
+        "ORDER BY %s DESC",
+        v13 ? "mean_exec_time" : "mean_time",
+        v13 ? "stddev_exec_time" : "stddev_time",
+        v13 ? "mean_plan_time" : "0",
+        v13 ? "total_exec_time" : "total_time");
+    
+    PGresult *res = control_query(sql);
+    for(int i = 0; i < PQntuples(res); i++)
+    {
+        StatementStats statement;
+        statement.query = PQgetvalue(res, i, 0);
+        statement.calls = atol(PQgetvalue(res, i, 1));
+        statement.exec_mean = atof(PQgetvalue(res, i, 2)) / 1000;
+        statement.exec_stddev = atof(PQgetvalue(res, i, 3)) / 1000;
+        statement.plan_mean = atof(PQgetvalue(res, i, 4)) / 1000;
+        statement.shared_hits = atoll(PQgetvalue(res, i, 5));
+        statement.shared_reads = atoll(PQgetvalue(res, i, 6));
+        stats.push_back(statement);
+    }
+    PQclear(res);
+}
+
+// query with its constants (literals, numbers and $n parameters) 
+// replaced by '?', and whitespace collapsed, to match the queries sent
+// with their normalized form in pg_stat_statements
+void query_skeleton(const char *query, std::string &skeleton)
+{
+    skeleton.clear();
+    const char *p = query;
+    while(*p)
+    {
+        if(*p == '\'')
+        {
+            // '' inside a literal is an escaped quote
+            for(p++; *p && !(*p == '\'' && *(p+1) != '\''); p++)
+                if(*p == '\'')
+                    p++;
+            if(*p)
+                p++;
+            skeleton += '?';
+        }
+        else if(*p == '$' && isdigit((unsigned char)*(p+1)))
+        {
+            for(p++; isdigit((unsigned char)*p); p++)
+                ;
+            skeleton += '?';
+        }
+        else if(isdigit((unsigned char)*p) && 
+            (skeleton.empty() || !(isalnum((unsigned char)skeleton.back()) || 
+                skeleton.back() == '_')))
+        {
+            for(; isdigit((unsigned char)*p) || *p == '.'; p++)
+                ;
+            skeleton += '?';
+        }
+        else if(isspace((unsigned char)*p))
+        {
+            for(; isspace((unsigned char)*p); p++)
+                ;
+            if(!skeleton.empty() && *p)
+                skeleton += ' ';
+        }
+        else
+            skeleton += *p++;
+    }
+}
+
+// server's times per normalized query, matched with the query types 
+// run by the workers to get the client's overhead: the client's mean 
+// latency minus server's mean planning and execution time
+void print_statement_report(const StatementStatsArray &stats, 
+    const RunSummary &summary)
+{
+    static const char *variant_names[] = {"A", "B"};
+    
+    std::string variant_skeletons[2];
+    for(int v = 0; v < num_variants; v++)
+    {
+        char query[2048];
+        render_query(query_templates[v], all_query_param_arrays[0][0], 
+            query, sizeof(query));
+        query_skeleton(query, variant_skeletons[v]);
+    }
+    
+    fprintf(report_out, 
+        "Server-side stats from pg_stat_statements (times are in seconds, "
+        "buffers per call):\n"
+        "Type      Calls        Exec mean      Exec stddev        Plan mean"
+        "     Hits    Reads      Client mean         Overhead  Query\n");
+    for(size_t i = 0; i < stats.size(); i++)
+    {
+        const StatementStats &statement = stats[i];
+        std::string skeleton;
+        query_skeleton(statement.query.c_str(), skeleton);
+        
+        int variant = -1;
+        for(int v = 0; v < num_variants && variant < 0; v++)
+            if(skeleton == variant_skeletons[v])
+                variant = v;
+        
+        fprintf(report_out, "%-4s %10ld %16.9lf %16.9lf %16.9lf %8.1lf %8.1lf ",
+            variant >= 0 ? variant_names[variant] : "-",
+            statement.calls, statement.exec_mean, statement.exec_stddev,
+            statement.plan_mean, 
+            (double)statement.shared_hits / statement.calls,
+            (double)statement.shared_reads / statement.calls);
+        
+        const LatencyHistogram *client = 
+            variant >= 0 ? &summary.variant_histograms[variant] : NULL;
+        if(client && client->total > 0)
+        {
+            double client_mean = client->sum / client->total;
+            fprintf(report_out, "%16.9lf %16.9lf  ", client_mean, 
+                client_mean - statement.exec_mean - statement.plan_mean);
+        }
+        else
+            fprintf(report_out, "%16s %16s  ", "-", "-");
+        fprintf(report_out, "%.60s\n", skeleton.c_str());
+    }
+}
+
+// connects the sampler, which waits for the run to start
+void start_wait_sampler()
+{
+    PGconn *conn = connect_db(-1);
+    if(wait_report_interval == 0)
+        wait_profiles.resize(num_iterations);
+    int rc = pthread_create(&wait_sampler_thread, NULL, wait_sampler_func, conn);
+    if(rc)
+        error_out("failed to create wait event sampler thread, error code=%d", rc);
+}
+
+void stop_wait_sampler()
+{
+    wait_sampler_stop.store(1, std::memory_order_release);
+    pthread_join(wait_sampler_thread, NULL);
+}
+
+// sleeps until the next poll of a sampler, interval_ns after the 
+// previous one; a slow poll delays the next one rather than catching up
+static void sleep_interval(int64_t &next, int64_t interval_ns)
+{
+    next += interval_ns;
+    int64_t now = now_ns();
+    if(next > now)
+    {
+        struct timespec sleep_time = {
+            (time_t)((next - now) / 1000000000), (long)((next - now) % 1000000000)
+        };
+        nanosleep(&sleep_time, NULL);
+    }
+    else
+        next = now;
+}
+
+// polls pg_stat_activity for the workers' backends at the sampling 
+// interval, counting them per wait event in the profile of the current
+// iteration, or of the current report interval
+void *wait_sampler_func(void *arg)
+{
+    PGconn *conn = (PGconn*)arg;
+    int64_t interval_ns = llround(wait_sample_interval * 1e9);
+    
+    struct timespec pause = {0, 1000000}; // 1 ms
+    while(run_iteration.load(std::memory_order_acquire) < 0)
+    {
+        if(wait_sampler_stop.load(std::memory_order_acquire))
+        {
+            PQfinish(conn);
+            return NULL;
+        }
+        nanosleep(&pause, NULL);
+    }
+    
+    std::string sql = 
+        "SELECT wait_event_type, wait_event, state FROM pg_stat_activity "
+        "WHERE pid IN (";
+    for(size_t w = 0; w < backend_pids.size(); w++)
+    {
+        char pid[16];
+        snprintf(pid, sizeof(pid), "%s%d", w ? ", " : "", backend_pids[w]);
+        sql += pid;
+    }
+    sql += ")";
+    
+    int64_t next = now_ns();
+    while(!wait_sampler_stop.load(std::memory_order_acquire))
+    {
+        int iteration = run_iteration.load(std::memory_order_acquire);
+        PGresult *res = PQexec(conn, sql.c_str());
+        if(PQresultStatus(res) != PGRES_TUPLES_OK)
+        {
+            fprintf(stderr, "warning: wait event sampling stopped: %s", 
+                PQerrorMessage(conn));
+            PQclear(res);
+            break;
+        }
+        
+        // profiles of the intervals are added as the run gets to them
+        size_t slot = iteration;
+        if(wait_report_interval > 0)
+        {
+            slot = (size_t)((now_ns() - run_start_ns) / (wait_report_interval * 1e9));
+            if(slot >= wait_profiles.size())
+                wait_profiles.resize(slot + 1);
+        }
+        WaitEventProfile &profile = wait_profiles[slot];
+        for(int i = 0; i < PQntuples(res); i++)
+        {
+            std::string event;
+            if(!PQgetisnull(res, i, 0))
+                event = std::string(PQgetvalue(res, i, 0)) + ":" + 
+                    PQgetvalue(res, i, 1);
+            else if(!strcmp(PQgetvalue(res, i, 2), "active"))
+                event = "CPU";
+            else
+                event = PQgetvalue(res, i, 2);
+            profile[event]++;
+        }
+        wait_samples++;
+        PQclear(res);
+        
+        sleep_interval(next, interval_ns);
+    }
+    
+    PQfinish(conn);
+    return NULL;
+}
+
+// event with its share of the samples, most frequent first
+static void sort_wait_events(const WaitEventProfile &profile, 
+    std::vector<std::pair<uint64_t, std::string> > &events, uint64_t &total)
+{
+    total = 0;
+    events.clear();
+    for(WaitEventProfile::const_iterator it = profile.begin(); 
+        it != profile.end(); ++it)
+    {
+        events.push_back(std::make_pair(it->second, it->first));
+        total += it->second;
+    }
+    std::sort(events.rbegin(), events.rend());
+}
+
+// profile of the whole run, and top events of each iteration or 
+// interval if more
+void print_wait_report()
+{
+    WaitEventProfile run_profile;
+    for(size_t i = 0; i < wait_profiles.size(); i++)
+        for(WaitEventProfile::const_iterator it = wait_profiles[i].begin(); 
+            it != wait_profiles[i].end(); ++it)
+            run_profile[it->first] += it->second;
+    
+    std::vector<std::pair<uint64_t, std::string> > events;
+    uint64_t total;
+    sort_wait_events(run_profile, events, total);
+    
+    fprintf(report_out, 
+        "Wait events of the workers' backends (%llu polls, every %.3lf s):\n"
+        "%-40s  Samples    Share\n",
+        (unsigned long long)wait_samples, wait_sample_interval, "Wait event");
+    for(size_t e = 0; e < events.size(); e++)
+        fprintf(report_out, "%-40s %8llu %7.1lf%%\n", events[e].second.c_str(),
+            (unsigned long long)events[e].first, 100.0 * events[e].first / total);
+    
+    if(wait_profiles.size() < 2)
+        return;
+    for(size_t i = 0; i < wait_profiles.size(); i++)
+    {
+        sort_wait_events(wait_profiles[i], events, total);
+        if(wait_report_interval > 0)
+            fprintf(report_out, "%10.3lf s:", i * wait_report_interval);
+        else
+            fprintf(report_out, "Iteration %zu:", i + 1);
+        for(size_t e = 0; e < events.size() && e < (size_t)wait_report_top; e++)
+            fprintf(report_out, "%s %s %.1lf%%", e ? "," : "", 
+                events[e].second.c_str(), 100.0 * events[e].first / total);
+        fputc('\n', report_out);
+    }
+}
+
+// value of the first occurrence of the numeric field in the JSON text,
+// or 0 if there's none; the first one is the root plan node's (which
+// includes its children), or top-level
+static double json_number(const char *json, const char *field)
+{
+    const char *p = strstr(json, field);
+    if(p == NULL)
+        return 0;
+    p += strlen(field);
+    while(*p == '"' || *p == ':' || *p == ' ')
+        p++;
+    return atof(p);
+}
+
+// number of distinct hypertable chunks scanned, per the relation 
+// names in the plan
+static int count_plan_chunks(const char *json)
+{
+    static const char *field = "\"Relation Name\": \"";
+    std::vector<std::string> chunks;
+    for(const char *p = strstr(json, field); p; p = strstr(p, field))
+    {
+        p += strlen(field);
+        const char *end = strchr(p, '"');
+        if(end == NULL)
+            break;
+        std::string name(p, end - p);
+        if(name.find("_chunk") != std::string::npos && 
+            std::find(chunks.begin(), chunks.end(), name) == chunks.end())
+            chunks.push_back(name);
+    }
+    return chunks.size();
+}
+
+// keeps the explain_top slowest distinct queries (parameters and type)
+// in the worker's list, each with its slowest execution: the same 
+// parameters may be among the slowest in several passes, but are 
+// explained once, leaving room for others
+void add_slow_query(SlowQueryArray &slowest, const SlowQuery &slow)
+{
+    SlowQueryArray::iterator it = slowest.begin();
+    while(it != slowest.end() && (it->param_index != slow.param_index || 
+        it->variant != slow.variant))
+        ++it;
+    if(it != slowest.end())
+    {
+        if(it->time_ns >= slow.time_ns)
+            return;
+        slowest.erase(it);
+    }
+    else if((int)slowest.size() == explain_top)
+        slowest.pop_back();
+    slowest.insert(std::upper_bound(slowest.begin(), slowest.end(), slow, 
+        std::greater<SlowQuery>()), slow);
+}
+
+// re-runs the slowest queries of all workers with EXPLAIN ANALYZE on
+// the control connection, writing their plans to the file, and 
+// reporting what they touched; note the re-run meets warmer caches
+void explain_slowest(const char *file_name)
+{
+    static const char *variant_names[] = {"A", "B"};
+    
+    SlowQueryArray slowest;
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+        slowest.insert(slowest.end(), worker_output_array[w].slowest.begin(),
+            worker_output_array[w].slowest.end());
+    std::sort(slowest.begin(), slowest.end(), std::greater<SlowQuery>());
+    if((int)slowest.size() > explain_top)
+        slowest.resize(explain_top);
+    
+    FILE *file = fopen(file_name, "w");
+    if(file == NULL)
+        error_out("cannot open explain file %s (errno=%d)", file_name, errno);
+    
+    fprintf(report_out, 
+        "Slowest queries, re-run with EXPLAIN ANALYZE (plans are in %s):\n"
+        "Type          Latency      Re-run time   Chunks     Hits    Reads  Parameters\n",
+        file_name);
+    fputc('[', file);
+    for(size_t i = 0; i < slowest.size(); i++)
+    {
+        const SlowQuery &slow = slowest[i];
+        const QueryParam &param = all_query_param_arrays[slow.worker][slow.param_index];
+        
+        static const char *prefix = "EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON) ";
+        char query[2048];
+        strcpy(query, prefix);
+        render_query(query_templates[slow.variant], param, 
+            query + strlen(prefix), sizeof(query) - strlen(prefix));
+        
+        PGresult *res = control_query(query);
+        const char *plan = PQntuples(res) > 0 ? PQgetvalue(res, 0, 0) : "null";
+        int chunks = count_plan_chunks(plan);
+        double hits = json_number(plan, "\"Shared Hit Blocks\"");
+        double reads = json_number(plan, "\"Shared Read Blocks\"");
+        double rerun_time = json_number(plan, "\"Execution Time\"") / 1000;
+        
+        fprintf(report_out, "%-4s %16.9lf %16.9lf %8d %8.0lf %8.0lf  %s,%s,%s\n",
+            variant_names[slow.variant], slow.time_ns / 1e9, rerun_time, 
+            chunks, hits, reads, param.host.c_str(), param.start_time.c_str(),
+            param.end_time.c_str());
+        
+        fprintf(file, "%s\n  {\"worker\": %d, \"type\": \"%s\", \"host\": ", 
+            i ? "," : "", slow.worker, variant_names[slow.variant]);
+        write_json_string(file, param.host.c_str());
+        fprintf(file, ", \"start_time\": ");
+        write_json_string(file, param.start_time.c_str());
+        fprintf(file, ", \"end_time\": ");
+        write_json_string(file, param.end_time.c_str());
+        fprintf(file, 
+            ", \"latency\": %.9lf, \"chunks\": %d, \"shared_hit_blocks\": %.0lf, "
+            "\"shared_read_blocks\": %.0lf,\n   \"plan\": %s}",
+            slow.time_ns / 1e9, chunks, hits, reads, plan);
+        PQclear(res);
+    }
+    fprintf(file, "\n]\n");
+    
+    if(fclose(file))
+        error_out("cannot write explain file %s (errno=%d)", file_name, errno);
+}
+
+// parses timestamp as YYYY-MM-DD[ HH:MI:SS], ignoring anything after 
+// it (fraction of a second, time zone), into seconds since the epoch
+// as if it were UTC; returns 0 if it can't be parsed
+int parse_timestamp(const char *str, time_t &seconds)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if(strptime(str, "%Y-%m-%d %H:%M:%S", &tm) == NULL)
+    {
+        memset(&tm, 0, sizeof(tm));
+        if(strptime(str, "%Y-%m-%d", &tm) == NULL)
+            return 0;
+    }
+    seconds = timegm(&tm);
+    return 1;
+}
+
+// loads the chunks' time ranges, and sets the number of chunks touched 
+// by each input row; both the ranges and the input are taken as local 
+// time of the session, so that they're comparable without time zones
+void map_chunks()
+{
+    std::vector<time_t> starts, ends;
+    PGresult *res = control_query(chunks_query);
+    for(int i = 0; i < PQntuples(res); i++)
+    {
+        time_t start, end;
+        if(parse_timestamp(PQgetvalue(res, i, 0), start) && 
+            parse_timestamp(PQgetvalue(res, i, 1), end))
+        {
+            starts.push_back(start);
+            ends.push_back(end);
+        }
+    }
+    PQclear(res);
+    if(starts.empty())
+        fprintf(stderr, "warning: no chunks found for cpu_usage\n");
+    
+    // chunks of different space partitions may share time ranges, so
+    // the count is of those starting before the range ends, less those
+    // ending before it starts
+    std::sort(starts.begin(), starts.end());
+    std::sort(ends.begin(), ends.end());
+    for(size_t w = 0; w < all_query_param_arrays.size(); w++)
+    {
+        QueryParamArray &params = all_query_param_arrays[w];
+        for(size_t i = 0; i < params.size(); i++)
+        {
+            time_t start, end;
+            if(!parse_timestamp(params[i].start_time.c_str(), start) ||
+                !parse_timestamp(params[i].end_time.c_str(), end))
+                continue;
+            params[i].chunks = 
+                (std::upper_bound(starts.begin(), starts.end(), end) - starts.begin()) -
+                (std::upper_bound(ends.begin(), ends.end(), start) - ends.begin());
+        }
+    }
+}
+
+static void print_bucket_row(const char *bucket, std::vector<double> &times)
+{
+    std::sort(times.begin(), times.end());
+    fprintf(report_out, "%-10s %10zu %16.9lf %16.9lf %16.9lf\n", bucket, 
+        times.size(), percentile(times, 50), percentile(times, 90), 
+        percentile(times, 99));
+}
+
+static void print_rows_buckets();
+
+// latency distribution by chunks touched, and by result rows in 
+// power-of-2 buckets
+void print_chunk_report()
+{
+    std::map<int, std::vector<double> > by_chunks;
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const QuerySampleArray &samples = worker_output_array[w].samples;
+        const QueryParamArray &params = all_query_param_arrays[w];
+        for(size_t i = 0; i < samples.size(); i++)
+            by_chunks[params[samples[i].param_index].chunks].push_back(
+                samples[i].time_ns / 1e9);
+    }
+    
+    fprintf(report_out, 
+        "Latency by chunks touched:\n"
+        "Chunks        Queries           Median              p90              p99\n");
+    for(std::map<int, std::vector<double> >::iterator it = by_chunks.begin(); 
+        it != by_chunks.end(); ++it)
+    {
+        char bucket[16];
+        if(it->first < 0)
+            strcpy(bucket, "unknown");
+        else
+            snprintf(bucket, sizeof(bucket), "%d", it->first);
+        print_bucket_row(bucket, it->second);
+    }
+    print_rows_buckets();
+}
+
+// latency by result rows in power-of-2 buckets
+static void print_rows_buckets()
+{
+    std::map<int, std::vector<double> > by_rows;
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const QuerySampleArray &samples = worker_output_array[w].samples;
+        for(size_t i = 0; i < samples.size(); i++)
+        {
+            int bucket = samples[i].rows > 0 ? 
+                64 - __builtin_clzll(samples[i].rows) : 0;
+            by_rows[bucket].push_back(samples[i].time_ns / 1e9);
+        }
+    }
+    
+    fprintf(report_out, 
+        "Latency by result rows:\n"
+        "Rows          Queries           Median              p90              p99\n");
+    for(std::map<int, std::vector<double> >::iterator it = by_rows.begin(); 
+        it != by_rows.end(); ++it)
+    {
+        // bucket b holds 2^(b-1) .. 2^b - 1 rows
+        char bucket[32];
+        if(it->first <= 1)
+            snprintf(bucket, sizeof(bucket), "%d", it->first);
+        else
+            snprintf(bucket, sizeof(bucket), "%lld-%lld", 
+                1LL << (it->first - 1), (1LL << it->first) - 1);
+        print_bucket_row(bucket, it->second);
+    }
+}
+
+// least squares fit of y = a + b x, with coefficient of determination;
+// returns 0 if x doesn't vary
+static int fit_line(const std::vector<double> &x, const std::vector<double> &y,
+    double &a, double &b, double &r2)
+{
+    size_t n = x.size();
+    double mean_x = std::accumulate(x.begin(), x.end(), 0.0) / n;
+    double mean_y = std::accumulate(y.begin(), y.end(), 0.0) / n;
+    double sxx = 0, sxy = 0, syy = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        sxx += (x[i] - mean_x) * (x[i] - mean_x);
+        sxy += (x[i] - mean_x) * (y[i] - mean_y);
+        syy += (y[i] - mean_y) * (y[i] - mean_y);
+    }
+    if(sxx == 0)
+        return 0;
+    b = sxy / sxx;
+    a = mean_y - b * mean_x;
+    r2 = syy > 0 ? sxy * sxy / (sxx * syy) : 1;
+    return 1;
+}
+
+// latency against the work the queries do: buckets and linear fits by 
+// the length of their time range and by the rows they return, and the
+// outliers of the latter, i.e. queries slow for other reasons
+void print_latency_model()
+{
+    std::vector<double> times, rows, ranges, range_times;
+    std::vector<const QueryParam*> sample_params;
+    std::map<int, std::vector<double> > by_range;
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const QuerySampleArray &samples = worker_output_array[w].samples;
+        const QueryParamArray &params = all_query_param_arrays[w];
+        
+        // ranges are computed once per input row, -1 if not parseable
+        std::vector<double> param_ranges(params.size(), -1);
+        for(size_t i = 0; i < params.size(); i++)
+        {
+            time_t start, end;
+            if(parse_timestamp(params[i].start_time.c_str(), start) &&
+                parse_timestamp(params[i].end_time.c_str(), end) && end >= start)
+                param_ranges[i] = end - start;
+        }
+        
+        for(size_t i = 0; i < samples.size(); i++)
+        {
+            double time = samples[i].time_ns / 1e9;
+            times.push_back(time);
+            rows.push_back(samples[i].rows);
+            sample_params.push_back(&params[samples[i].param_index]);
+            
+            double range = param_ranges[samples[i].param_index];
+            if(range < 0)
+                continue;
+            ranges.push_back(range / 3600);
+            range_times.push_back(time);
+            
+            // bucket b holds ranges up to 2^b hours
+            int bucket = range > 3600 ? 
+                64 - __builtin_clzll((unsigned long long)ceil(range / 3600) - 1) : 0;
+            by_range[bucket].push_back(time);
+        }
+    }
+    if(times.empty())
+        return;
+    
+    fprintf(report_out, 
+        "Latency by time range length:\n"
+        "Range         Queries           Median              p90              p99\n");
+    for(std::map<int, std::vector<double> >::iterator it = by_range.begin(); 
+        it != by_range.end(); ++it)
+    {
+        char bucket[24];
+        snprintf(bucket, sizeof(bucket), "<=%lldh", 1LL << it->first);
+        print_bucket_row(bucket, it->second);
+    }
+    // the rows buckets are already in the chunks report, if any
+    if(!chunk_analysis)
+        print_rows_buckets();
+    
+    double a, b, r2;
+    fprintf(report_out, "Linear fit of latency (in seconds):\n");
+    if(!ranges.empty() && fit_line(ranges, range_times, a, b, r2))
+        fprintf(report_out, "  by range: %.9lf + %.9lf per hour (R^2 %.3lf)\n", 
+            a, b, r2);
+    else
+        fprintf(report_out, "  by range: n/a, the ranges don't vary\n");
+    if(!fit_line(rows, times, a, b, r2))
+    {
+        fprintf(report_out, "  by rows:  n/a, the rows don't vary\n");
+        return;
+    }
+    fprintf(report_out, "  by rows:  %.9lf + %.9lf per row (R^2 %.3lf)\n", 
+        a, b, r2);
+    
+    // the spread of residuals is taken robustly, from their median 
+    // absolute deviation, not to be inflated by the outliers themselves;
+    // if most residuals are equal (quantized latencies), it's taken from
+    // their standard deviation instead, and if they all are, nothing is
+    // an outlier
+    std::vector<double> residuals(times.size()), deviations(times.size());
+    for(size_t i = 0; i < times.size(); i++)
+        residuals[i] = times[i] - (a + b * rows[i]);
+    std::vector<double> sorted(residuals);
+    std::sort(sorted.begin(), sorted.end());
+    double median = percentile(sorted, 50);
+    for(size_t i = 0; i < residuals.size(); i++)
+        deviations[i] = fabs(residuals[i] - median);
+    std::sort(deviations.begin(), deviations.end());
+    double sigma = 1.4826 * percentile(deviations, 50);
+    if(sigma == 0)
+    {
+        double mean = std::accumulate(residuals.begin(), residuals.end(), 0.0) / 
+            residuals.size(), sum_squares = 0;
+        for(size_t i = 0; i < residuals.size(); i++)
+            sum_squares += (residuals[i] - mean) * (residuals[i] - mean);
+        sigma = sqrt(sum_squares / residuals.size());
+    }
+    
+    std::vector<std::pair<double, size_t> > outliers;
+    for(size_t i = 0; i < residuals.size(); i++)
+        if(sigma > 0 && residuals[i] - median > outlier_sigmas * sigma)
+            outliers.push_back(std::make_pair(residuals[i], i));
+    std::sort(outliers.rbegin(), outliers.rend());
+    
+    fprintf(report_out, 
+        "Queries slower than the fit by rows by over %.0lf sigma: %zu of %zu\n",
+        outlier_sigmas, outliers.size(), times.size());
+    if(outliers.empty())
+        return;
+    fprintf(report_out, 
+        "      Latency        Predicted       Rows  Parameters\n");
+    for(size_t k = 0; k < outliers.size() && k < (size_t)outlier_report_top; k++)
+    {
+        size_t i = outliers[k].second;
+        const QueryParam &param = *sample_params[i];
+        fprintf(report_out, "%13.9lf %16.9lf %10.0lf  %s,%s,%s\n", 
+            times[i], a + b * rows[i], rows[i], param.host.c_str(), 
+            param.start_time.c_str(), param.end_time.c_str());
+    }
+}
+
+// connects the monitor, which waits for the run to start
+void start_background_monitor()
+{
+    PGconn *conn = connect_db(-1);
+    int rc = pthread_create(&background_thread, NULL, background_monitor_func, conn);
+    if(rc)
+        error_out("failed to create background monitor thread, error code=%d", rc);
+}
+
+void stop_background_monitor()
+{
+    background_stop.store(1, std::memory_order_release);
+    pthread_join(background_thread, NULL);
+}
+
+// snapshots the background activity at the monitor's interval, and once 
+// more at the end of the run, to cover its last interval; checkpointer's
+// counters moved from pg_stat_bgwriter to pg_stat_checkpointer in 17,
+// and a checkpoint is running when the checkpointer is not idle in its
+// main loop
+void *background_monitor_func(void *arg)
+{
+    PGconn *conn = (PGconn*)arg;
+    int64_t interval_ns = llround(background_interval * 1e9);
+    
+    struct timespec pause = {0, 1000000}; // 1 ms
+    while(run_iteration.load(std::memory_order_acquire) < 0)
+    {
+        if(background_stop.load(std::memory_order_acquire))
+        {
+            PQfinish(conn);
+            return NULL;
+        }
+        nanosleep(&pause, NULL);
+    }
+    
+    const char *sql = PQserverVersion(conn) >= 170000 ?
+        "SELECT c.num_timed + c.num_requested, "
+        "c.buffers_written + b.buffers_clean, "
+        "pg_wal_lsn_diff(CASE WHEN pg_is_in_recovery() "
+        "THEN pg_last_wal_replay_lsn() ELSE pg_current_wal_lsn() END, '0/0')::bigint, "
+        "(SELECT count(*) FROM pg_stat_progress_vacuum), "
+        "(SELECT count(*) FROM pg_stat_activity WHERE backend_type = 'checkpointer' "
+        "AND wait_event IS DISTINCT FROM 'CheckpointerMain') "
+        "FROM pg_stat_checkpointer c, pg_stat_bgwriter b" :
+        "SELECT b.checkpoints_timed + b.checkpoints_req, "
+        "b.buffers_checkpoint + b.buffers_clean, "
+        "pg_wal_lsn_diff(CASE WHEN pg_is_in_recovery() "
+        "THEN pg_last_wal_replay_lsn() ELSE pg_current_wal_lsn() END, '0/0')::bigint, "
+        "(SELECT count(*) FROM pg_stat_progress_vacuum), "
+        "(SELECT count(*) FROM pg_stat_activity WHERE backend_type = 'checkpointer' "
+        "AND wait_event IS DISTINCT FROM 'CheckpointerMain') "
+        "FROM pg_stat_bgwriter b";
+    
+    int64_t next = now_ns();
+    for(int last = 0; !last; )
+    {
+        last = background_stop.load(std::memory_order_acquire);
+        BackgroundSnapshot snapshot;
+        snapshot.time_ns = now_ns() - run_start_ns;
+        PGresult *res = PQexec(conn, sql);
+        if(PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1)
+        {
+            fprintf(stderr, "warning: background activity monitoring stopped: %s", 
+                PQerrorMessage(conn));
+            PQclear(res);
+            break;
+        }
+        snapshot.checkpoints = atoll(PQgetvalue(res, 0, 0));
+        snapshot.buffers_written = atoll(PQgetvalue(res, 0, 1));
+        snapshot.wal_bytes = atoll(PQgetvalue(res, 0, 2));
+        snapshot.vacuums = atoi(PQgetvalue(res, 0, 3));
+        snapshot.checkpoint_running = atoi(PQgetvalue(res, 0, 4));
+        PQclear(res);
+        background_snapshots.push_back(snapshot);
+        
+        if(!last)
+            sleep_interval(next, interval_ns);
+    }
+    
+    PQfinish(conn);
+    return NULL;
+}
+
+static bool snapshot_before(const BackgroundSnapshot &snapshot, int64_t ns)
+{
+    return snapshot.time_ns < ns;
+}
+
+// latency of the queries completed in each interval between snapshots,
+// and the intervals whose p99 stands out, with the background activity 
+// seen in them: a checkpoint running or completed, vacuums running, and 
+// the buffers written and WAL generated
+void print_background_report()
+{
+    size_t num_intervals = background_snapshots.size() > 1 ? 
+        background_snapshots.size() - 1 : 0;
+    if(num_intervals == 0)
+        return;
+    
+    std::vector<std::vector<double> > interval_times(num_intervals);
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const QuerySampleArray &samples = worker_output_array[w].samples;
+        for(size_t i = 0; i < samples.size(); i++)
+        {
+            // the interval ending at or after the query
+            size_t k = std::lower_bound(background_snapshots.begin() + 1, 
+                background_snapshots.end(), samples[i].end_ns, 
+                snapshot_before) - background_snapshots.begin();
+            if(k >= 1 && k <= num_intervals)
+                interval_times[k - 1].push_back(samples[i].time_ns / 1e9);
+        }
+    }
+    
+    std::vector<double> p99s(num_intervals, -1), sorted_p99s;
+    for(size_t k = 0; k < num_intervals; k++)
+    {
+        std::vector<double> &times = interval_times[k];
+        if(times.empty())
+            continue;
+        std::sort(times.begin(), times.end());
+        p99s[k] = percentile(times, 99);
+        sorted_p99s.push_back(p99s[k]);
+    }
+    if(sorted_p99s.empty())
+        return;
+    std::sort(sorted_p99s.begin(), sorted_p99s.end());
+    double median_p99 = percentile(sorted_p99s, 50);
+    
+    int busy_intervals = 0, slow_intervals = 0, slow_busy_intervals = 0;
+    std::vector<std::pair<double, size_t> > slow;
+    for(size_t k = 0; k < num_intervals; k++)
+    {
+        const BackgroundSnapshot &from = background_snapshots[k];
+        const BackgroundSnapshot &to = background_snapshots[k + 1];
+        int busy = to.checkpoints > from.checkpoints || 
+            from.checkpoint_running || to.checkpoint_running || 
+            from.vacuums || to.vacuums;
+        busy_intervals += busy;
+        if(p99s[k] > median_p99 * slow_interval_ratio)
+        {
+            slow_intervals++;
+            slow_busy_intervals += busy;
+            slow.push_back(std::make_pair(p99s[k], k));
+        }
+    }
+    
+    fprintf(report_out, 
+        "Background activity (%zu intervals of %.3lf s): checkpoint or vacuum "
+        "in %d of them\n"
+        "Intervals with p99 above %.1lfx the median interval's p99 (%.9lf): %d, "
+        "%d of them with checkpoint or vacuum\n",
+        num_intervals, background_interval, busy_intervals, 
+        slow_interval_ratio, median_p99, slow_intervals, slow_busy_intervals);
+    if(slow.empty())
+        return;
+    
+    // the slowest first
+    std::sort(slow.rbegin(), slow.rend());
+    fprintf(report_out, 
+        "    Start, s  Queries              p99  Checkpoint  Vacuums  "
+        "Buffers written       WAL bytes\n");
+    for(size_t i = 0; i < slow.size() && i < (size_t)background_report_top; i++)
+    {
+        size_t k = slow[i].second;
+        const BackgroundSnapshot &from = background_snapshots[k];
+        const BackgroundSnapshot &to = background_snapshots[k + 1];
+        const char *checkpoint = to.checkpoints > from.checkpoints ? "completed" :
+            from.checkpoint_running || to.checkpoint_running ? "running" : "-";
+        fprintf(report_out, "%12.3lf %8zu %16.9lf  %-10s %8d %16lld %15lld\n",
+            from.time_ns / 1e9, interval_times[k].size(), p99s[k], checkpoint,
+            std::max(from.vacuums, to.vacuums), 
+            (long long)(to.buffers_written - from.buffers_written),
+            (long long)(to.wal_bytes - from.wal_bytes));
+    }
+}
+
+// chunk names differ by the time range, not by the plan: 
+// _hyper_1_2_chunk_cpu_usage_ts_idx becomes _hyper_chunk_cpu_usage_ts_idx
+static std::string normalize_chunk_name(const std::string &name)
+{
+    if(name.compare(0, 7, "_hyper_") != 0)
+        return name;
+    size_t p = 7;
+    while(p < name.size() && (isdigit(name[p]) || name[p] == '_'))
+        p++;
+    if(name.compare(p, 5, "chunk") != 0)
+        return name;
+    return "_hyper_" + name.substr(p);
+}
+
+// parses a JSON string at p, leaving p past its closing quote
+static std::string parse_json_string(const char *&p)
+{
+    std::string str;
+    for(p++; *p && *p != '"'; p++)
+    {
+        if(*p == '\\' && p[1])
+            p++;
+        str += *p;
+    }
+    if(*p)
+        p++;
+    return str;
+}
+
+// structure of the plan node (or any JSON value) at p, leaving p past 
+// it: node type with the strategy, join type, relation and index, and
+// the structures of the subplans in brackets; estimates and other 
+// scalars are left out, and identical adjacent subplans, like scans of
+// chunks, are collapsed into one
+static std::string plan_structure(const char *&p)
+{
+    static const char *prefixes[][2] = {
+        {"Node Type", ""}, {"Custom Plan Provider", " "}, {"Strategy", " "}, 
+        {"Join Type", " "}, {"Relation Name", " on "}, {"Index Name", " using "}
+    };
+    
+    while(isspace(*p))
+        p++;
+    if(*p == '"')
+    {
+        parse_json_string(p);
+        return "";
+    }
+    if(*p != '{' && *p != '[')
+    {
+        while(*p && *p != ',' && *p != '}' && *p != ']')
+            p++;
+        return "";
+    }
+    
+    // array: structures of the elements
+    if(*p == '[')
+    {
+        std::vector<std::string> items;
+        for(p++; *p && *p != ']'; )
+        {
+            std::string item = plan_structure(p);
+            if(!item.empty() && (items.empty() || items.back() != item))
+                items.push_back(item);
+            while(isspace(*p) || *p == ',')
+                p++;
+        }
+        if(*p)
+            p++;
+        std::string structure;
+        for(size_t i = 0; i < items.size(); i++)
+            structure += (i ? ", " : "") + items[i];
+        return structure;
+    }
+    
+    // object: its own fields, then the nested plans
+    std::string fields[6], nested;
+    for(p++; *p && *p != '}'; )
+    {
+        while(isspace(*p) || *p == ',')
+            p++;
+        if(*p != '"')
+            break;
+        std::string key = parse_json_string(p);
+        while(isspace(*p) || *p == ':')
+            p++;
+        int f = 0;
+        while(f < 6 && key != prefixes[f][0])
+            f++;
+        if(f < 6 && *p == '"')
+            fields[f] = prefixes[f][1] + normalize_chunk_name(parse_json_string(p));
+        else if(key == "Plans")
+            nested = "[" + plan_structure(p) + "]";
+        else
+            nested += plan_structure(p);
+        while(isspace(*p) || *p == ',')
+            p++;
+    }
+    if(*p)
+        p++;
+    std::string structure;
+    for(int f = 0; f < 6; f++)
+        if(!fields[f].empty())
+            structure += fields[f];
+    return structure + nested;
+}
+
+// FNV-1a
+static uint64_t hash_string(const std::string &str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < str.size(); i++)
+        hash = (hash ^ (unsigned char)str[i]) * 1099511628211ULL;
+    return hash;
+}
+
+// explains the just executed query on the worker's connection, and 
+// accounts its latency to the structure of the plan
+void track_plan(PGconn *conn, const char *query, int variant, int64_t end_ns,
+    double time, PlanUsageMap &plans)
+{
+    std::string sql = std::string("EXPLAIN (FORMAT JSON) ") + query;
+    PGresult *res = PQexec(conn, sql.c_str());
+    if(PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) < 1)
+    {
+        fprintf(stderr, "warning: cannot explain query \"%s\": %s", 
+            query, PQerrorMessage(conn));
+        PQclear(res);
+        return;
+    }
+    const char *p = PQgetvalue(res, 0, 0);
+    std::string structure = plan_structure(p);
+    PQclear(res);
+    
+    // the variants run different queries, so their plans are kept apart
+    uint64_t hash = hash_string(structure) + variant;
+    PlanUsageMap::iterator it = plans.find(hash);
+    if(it == plans.end())
+    {
+        PlanUsage usage;
+        usage.structure = structure;
+        usage.variant = variant;
+        usage.first_ns = end_ns;
+        usage.last_ns = end_ns;
+        it = plans.insert(std::make_pair(hash, usage)).first;
+    }
+    PlanUsage &usage = it->second;
+    usage.first_ns = std::min(usage.first_ns, end_ns);
+    usage.last_ns = std::max(usage.last_ns, end_ns);
+    usage.times.push_back(time);
+}
+
+// distinct plans of all workers, the most frequent first, with their 
+// latency and the span of the run they were seen in; plans seen in 
+// overlapping spans point at parameter-dependent plans, and successive 
+// ones at a plan change mid-run
+void print_plan_report()
+{
+    static const char *variant_names[] = {"A", "B"};
+    
+    PlanUsageMap plans;
+    for(size_t w = 0; w < worker_output_array.size(); w++)
+    {
+        const PlanUsageMap &worker_plans = worker_output_array[w].plans;
+        for(PlanUsageMap::const_iterator it = worker_plans.begin(); 
+            it != worker_plans.end(); ++it)
+        {
+            PlanUsageMap::iterator found = plans.find(it->first);
+            if(found == plans.end())
+            {
+                plans.insert(*it);
+                continue;
+            }
+            PlanUsage &usage = found->second;
+            usage.first_ns = std::min(usage.first_ns, it->second.first_ns);
+            usage.last_ns = std::max(usage.last_ns, it->second.last_ns);
+            usage.times.insert(usage.times.end(), 
+                it->second.times.begin(), it->second.times.end());
+        }
+    }
+    
+    size_t total = 0;
+    std::vector<std::pair<size_t, uint64_t> > order;
+    for(PlanUsageMap::iterator it = plans.begin(); it != plans.end(); ++it)
+    {
+        total += it->second.times.size();
+        order.push_back(std::make_pair(it->second.times.size(), it->first));
+    }
+    std::sort(order.rbegin(), order.rend());
+    
+    fprintf(report_out, 
+        "Plans of %zu explained executions (%.1lf%% of the input rows): %zu "
+        "distinct\n", total, plan_fraction * 100, plans.size());
+    for(size_t i = 0; i < order.size(); i++)
+    {
+        PlanUsage &usage = plans[order[i].second];
+        std::vector<double> &times = usage.times;
+        std::sort(times.begin(), times.end());
+        fprintf(report_out, 
+            "Plan %016llx%s%s: %zu executions (%.1lf%%), seen %.3lf..%.3lf s\n"
+            "  %s\n"
+            "  median %.9lf, p90 %.9lf, p99 %.9lf, max %.9lf\n",
+            (unsigned long long)order[i].second, 
+            num_variants > 1 ? ", query " : "", 
+            num_variants > 1 ? variant_names[usage.variant] : "",
+            times.size(), 100.0 * times.size() / total,
+            usage.first_ns / 1e9, usage.last_ns / 1e9, usage.structure.c_str(),
+            percentile(times, 50), percentile(times, 90), percentile(times, 99),
+            times.back());
+    }
+}
+
+// opens /proc files of the worker's backend, checking that it's a local 
+// postgres process, not one with the same PID on another host
+void open_backend_proc(int pid, int worker_no, BackendProc &proc)
+{
+    char path[64], comm[64] = "";
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    FILE *file = fopen(path, "r");
+    if(file)
+    {
+        if(!fgets(comm, sizeof(comm), file))
+            comm[0] = '\0';
+        fclose(file);
+    }
+    if(strncmp(comm, "postgres", 8) != 0)
+        error_out("backend %d of worker %d is not a local postgres process, "
+            "--backend-usage needs the server on this host", pid, worker_no);
+    
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    proc.stat_fd = open(path, O_RDONLY);
+    if(proc.stat_fd < 0)
+        error_out("cannot open %s (errno=%d)", path, errno);
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    proc.io_fd = open(path, O_RDONLY);
+    if(proc.io_fd < 0 && worker_no == 0)
+        fprintf(stderr, "warning: cannot read %s (errno=%d), backend I/O is "
+            "not reported\n", path, errno);
+}
+
+// value of the field in the text of /proc/<pid>/io, 0 if not found
+static int64_t proc_io_field(const char *text, const char *field)
+{
+    const char *p = strstr(text, field);
+    return p ? atoll(p + strlen(field)) : 0;
+}
+
+// current usage of the backend; the files are read from their start 
+// without reopening them
+void read_backend_usage(const BackendProc &proc, BackendUsage &usage)
+{
+    char buf[1024];
+    ssize_t len = pread(proc.stat_fd, buf, sizeof(buf) - 1, 0);
+    buf[len > 0 ? len : 0] = '\0';
+    
+    // the command in parentheses may contain spaces, so fields are 
+    // counted from the last parenthesis: utime and stime are 14th and
+    // 15th, the state being 3rd
+    const char *p = strrchr(buf, ')');
+    unsigned long long utime = 0, stime = 0;
+    if(p)
+        sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+            &utime, &stime);
+    usage.user_ticks = utime;
+    usage.system_ticks = stime;
+    
+    if(proc.io_fd < 0)
+        return;
+    len = pread(proc.io_fd, buf, sizeof(buf) - 1, 0);
+    buf[len > 0 ? len : 0] = '\0';
+    usage.read_chars = proc_io_field(buf, "rchar:");
+    usage.read_bytes = proc_io_field(buf, "\nread_bytes:");
+    usage.write_bytes = proc_io_field(buf, "\nwrite_bytes:");
+}
+
+// backends' CPU and I/O per query next to the client's latency; CPU 
+// times are in clock ticks, so only their totals over many queries are 
+// meaningful, and the share of latency not covered by the backend's CPU
+// is spent in I/O, waits and the network
+void print_backend_report()
+{
+    double ticks_per_second = sysconf(_SC_CLK_TCK);
+    BackendUsage total;
+    double queries = 0, latency = 0;
+    
+    fprintf(report_out, 
+        "Server backends (from /proc, times in seconds, I/O in bytes):\n"
+        "Worker      Queries   Latency/query       CPU/query   CPU share"
+        "   Read/query   Storage read/query   Storage write/query\n");
+    for(size_t w = 0; w <= worker_output_array.size(); w++)
+    {
+        int all = w == worker_output_array.size();
+        if(!all)
+        {
+            const WorkerOutput &output = worker_output_array[w];
+            total.user_ticks += output.backend.user_ticks;
+            total.system_ticks += output.backend.system_ticks;
+            total.read_chars += output.backend.read_chars;
+            total.read_bytes += output.backend.read_bytes;
+            total.write_bytes += output.backend.write_bytes;
+            queries += output.total_queries;
+            latency += output.total_time;
+            if(!show_breakdown)
+                continue;
+        }
+        const BackendUsage &usage = all ? total : worker_output_array[w].backend;
+        double n = all ? queries : worker_output_array[w].total_queries;
+        double time = all ? latency : worker_output_array[w].total_time;
+        if(n == 0)
+            continue;
+        double cpu = (usage.user_ticks + usage.system_ticks) / ticks_per_second;
+        char worker[24];
+        if(all)
+            strcpy(worker, "All");
+        else
+            snprintf(worker, sizeof(worker), "%zu", w);
+        fprintf(report_out, 
+            "%-6s %12.0lf %15.9lf %15.9lf %10.1lf%% %12.1lf %20.1lf %21.1lf\n",
+            worker, n, time / n, cpu / n, time > 0 ? 100 * cpu / time : 0, 
+            usage.read_chars / n, usage.read_bytes / n, usage.write_bytes / n);
+    }
+    fprintf(report_out, "Backend CPU split: user %.3lf s, system %.3lf s\n",
+        total.user_ticks / ticks_per_second, total.system_ticks / ticks_per_second);
+}
+
+// adds the values of the single-row query on the control connection 
+// under the names of its columns, in order, leaving out the null ones; 
+// returns 0 if the query fails or returns no row, e.g. without TimescaleDB
+static int add_server_values(Environment &environment, const char **names, 
+    int num_names, const char *sql)
+{
+    PGresult *res = PQexec(control_conn, sql);
+    int found = PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1 &&
+        PQnfields(res) == num_names;
+    for(int i = 0; found && i < num_names; i++)
+        if(!PQgetisnull(res, 0, i))
+            environment.push_back(std::make_pair(names[i], PQgetvalue(res, 0, i)));
+    PQclear(res);
+    return found;
+}
+
+static void add_server_value(Environment &environment, const char *name, 
+    const char *sql)
+{
+    add_server_values(environment, &name, 1, sql);
+}
+
+// first value of the field in /proc/cpuinfo, like "model name"
+static std::string cpuinfo_value(const char *field)
+{
+    std::string value;
+    FILE *file = fopen("/proc/cpuinfo", "r");
+    if(file == NULL)
+        return value;
+    char line[512];
+    while(fgets(line, sizeof(line), file))
+    {
+        const char *colon = strchr(line, ':');
+        if(strncmp(line, field, strlen(field)) != 0 || colon == NULL)
+            continue;
+        for(colon++; isspace(*colon); colon++)
+            ;
+        value = colon;
+        value.erase(value.find_last_not_of(" \n") + 1);
+        break;
+    }
+    fclose(file);
+    return value;
+}
+
+// collects the server's side on the control connection, then the client's
+void collect_environment(Environment &environment)
+{
+    static const char *settings[] = {
+        "shared_buffers", "work_mem", "jit", "max_parallel_workers_per_gather",
+        "effective_io_concurrency"
+    };
+    
+    add_server_value(environment, "server_version", "SHOW server_version");
+    add_server_value(environment, "timescaledb_version", 
+        "SELECT extversion FROM pg_extension WHERE extname = 'timescaledb'");
+    for(size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++)
+    {
+        std::string sql = std::string("SHOW ") + settings[i];
+        add_server_value(environment, settings[i], sql.c_str());
+    }
+    add_server_value(environment, "chunk_time_interval", 
+        "SELECT time_interval::text FROM timescaledb_information.dimensions "
+        "WHERE hypertable_name = 'cpu_usage' AND dimension_number = 1");
+    add_server_value(environment, "num_chunks", 
+        "SELECT num_chunks FROM timescaledb_information.hypertables "
+        "WHERE hypertable_name = 'cpu_usage'");
+    
+    // a hypertable's own relation is empty, its data is in the chunks
+    static const char *sizes[] = {"table_bytes", "index_bytes"};
+    if(!add_server_values(environment, sizes, 2, 
+        "SELECT table_bytes, index_bytes FROM hypertable_detailed_size('cpu_usage')"))
+        add_server_values(environment, sizes, 2, 
+            "SELECT pg_table_size('cpu_usage'), pg_indexes_size('cpu_usage')");
+    
+    std::string cpu = cpuinfo_value("model name");
+    if(!cpu.empty())
+        environment.push_back(std::make_pair("client_cpu", cpu));
+    char buf[256]; // fits three utsname fields
+    snprintf(buf, sizeof(buf), "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+    environment.push_back(std::make_pair("client_cores", buf));
+    struct utsname name;
+    if(uname(&name) == 0)
+    {
+        snprintf(buf, sizeof(buf), "%s %s %s", name.sysname, name.release, 
+            name.machine);
+        environment.push_back(std::make_pair("kernel", buf));
+    }
+    
+    // e.g. 160002 for 16.2, or 90624 for 9.6.24
+    int version = PQlibVersion();
+    if(version >= 100000)
+        snprintf(buf, sizeof(buf), "%d.%d", version / 10000, version % 10000);
+    else
+        snprintf(buf, sizeof(buf), "%d.%d.%d", version / 10000, 
+            version / 100 % 100, version % 100);
+    environment.push_back(std::make_pair("libpq_version", buf));
+}
+
+// values that differ between the baseline's environment and the 
+// current one, or are present in only one of them
+void print_environment_diff(const Environment &baseline, 
+    const Environment &current)
+{
+    if(baseline.empty())
+    {
+        fprintf(report_out, "Environment: not recorded in the baseline\n");
+        return;
+    }
+    
+    std::map<std::string, std::string> base(baseline.begin(), baseline.end());
+    std::vector<std::string> lines;
+    for(size_t i = 0; i < current.size(); i++)
+    {
+        std::map<std::string, std::string>::iterator it = 
+            base.find(current[i].first);
+        if(it == base.end() || it->second != current[i].second)
+            lines.push_back(current[i].first + ": " + 
+                (it == base.end() ? "-" : it->second) + " -> " + 
+                current[i].second);
+        if(it != base.end())
+            base.erase(it);
+    }
+    for(size_t i = 0; i < baseline.size(); i++)
+        if(base.count(baseline[i].first))
+            lines.push_back(baseline[i].first + ": " + baseline[i].second + 
+                " -> -");
+    
+    if(lines.empty())
+    {
+        fprintf(report_out, "Environment: same as the baseline\n");
+        return;
+    }
+    fprintf(report_out, "Environment changes since the baseline:\n");
+    for(size_t i = 0; i < lines.size(); i++)
+        fprintf(report_out, "  %s\n", lines[i].c_str());
+}
+
+// listens on the loopback interface only, failing upfront if the port
+// is taken
+void start_metrics_server()
+{
+    for(size_t w = 0; w < all_query_param_arrays.size(); w++)
+        live_metrics.push_back(new LiveMetrics());
+    
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        error_out("cannot create metrics socket (errno=%d)", errno);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(metrics_port);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 16))
+        error_out("cannot listen on metrics port %d (errno=%d)", metrics_port, errno);
+    
+    int rc = pthread_create(&metrics_thread, NULL, metrics_server_func, 
+        (void*)(intptr_t)fd);
+    if(rc)
+        error_out("failed to create metrics server thread, error code=%d", rc);
+}
+
+void stop_metrics_server()
+{
+    metrics_stop.store(1, std::memory_order_release);
+    pthread_join(metrics_thread, NULL);
+}
+
+// current metrics in Prometheus text exposition format; queries are 
+// counted once measured, i.e. not in the warm-up, and they are all 
+// successful, as a failed query ends the run
+static std::string render_metrics()
+{
+    static const char *variant_names[] = {"A", "B"};
+    std::string text;
+    char line[256];
+    
+    uint64_t queries[2] = {0, 0}, sum_ns[2] = {0, 0};
+    uint64_t buckets[2][num_metrics_buckets + 1] = {};
+    int in_flight = 0;
+    for(size_t w = 0; w < live_metrics.size(); w++)
+    {
+        const LiveMetrics &live = *live_metrics[w];
+        in_flight += live.in_flight.load(std::memory_order_relaxed);
+        for(int v = 0; v < num_variants; v++)
+        {
+            queries[v] += live.queries[v].load(std::memory_order_relaxed);
+            sum_ns[v] += live.sum_ns[v].load(std::memory_order_relaxed);
+            for(int b = 0; b <= num_metrics_buckets; b++)
+                buckets[v][b] += live.buckets[v][b].load(std::memory_order_relaxed);
+        }
+    }
+    
+    text += "# HELP pq_bench_queries_total Measured queries completed.\n"
+        "# TYPE pq_bench_queries_total counter\n";
+    for(int v = 0; v < num_variants; v++)
+    {
+        snprintf(line, sizeof(line), 
+            "pq_bench_queries_total{type=\"%s\",status=\"ok\"} %llu\n",
+            variant_names[v], (unsigned long long)queries[v]);
+        text += line;
+    }
+    
+    // the buckets are cumulative, and the count is that of the last one, 
+    // the counters being read at different moments
+    text += "# HELP pq_bench_query_duration_seconds Client-observed query latency.\n"
+        "# TYPE pq_bench_query_duration_seconds histogram\n";
+    for(int v = 0; v < num_variants; v++)
+    {
+        uint64_t count = 0;
+        for(int b = 0; b <= num_metrics_buckets; b++)
+        {
+            char le[32];
+            count += buckets[v][b];
+            if(b < num_metrics_buckets)
+                snprintf(le, sizeof(le), "%g", metrics_buckets[b]);
+            else
+                snprintf(le, sizeof(le), "+Inf");
+            snprintf(line, sizeof(line), 
+                "pq_bench_query_duration_seconds_bucket{type=\"%s\",le=\"%s\"} %llu\n",
+                variant_names[v], le, (unsigned long long)count);
+            text += line;
+        }
+        snprintf(line, sizeof(line), 
+            "pq_bench_query_duration_seconds_sum{type=\"%s\"} %.9lf\n"
+            "pq_bench_query_duration_seconds_count{type=\"%s\"} %llu\n",
+            variant_names[v], sum_ns[v] / 1e9, variant_names[v], 
+            (unsigned long long)count);
+        text += line;
+    }
+    
+    snprintf(line, sizeof(line), 
+        "# HELP pq_bench_queries_in_flight Queries sent and not completed yet.\n"
+        "# TYPE pq_bench_queries_in_flight gauge\n"
+        "pq_bench_queries_in_flight %d\n", in_flight);
+    text += line;
+    
+    // busy ratio is over the time since the start of the run
+    int started = run_iteration.load(std::memory_order_acquire) >= 0;
+    double elapsed = started ? (now_ns() - run_start_ns) / 1e9 : 0;
+    std::string ratios = 
+        "# HELP pq_bench_worker_busy_ratio Share of the run spent in queries.\n"
+        "# TYPE pq_bench_worker_busy_ratio gauge\n";
+    text += "# HELP pq_bench_worker_busy_seconds_total Time spent in queries.\n"
+        "# TYPE pq_bench_worker_busy_seconds_total counter\n";
+    for(size_t w = 0; w < live_metrics.size(); w++)
+    {
+        double busy = live_metrics[w]->busy_ns.load(std::memory_order_relaxed) / 1e9;
+        snprintf(line, sizeof(line), 
+            "pq_bench_worker_busy_seconds_total{worker=\"%zu\"} %.9lf\n", w, busy);
+        text += line;
+        snprintf(line, sizeof(line), 
+            "pq_bench_worker_busy_ratio{worker=\"%zu\"} %.6lf\n", w, 
+            elapsed > 0 ? fmin(busy / elapsed, 1) : 0);
+        ratios += line;
+    }
+    return text + ratios;
+}
+
+// sends all the data, giving up if the client goes away
+static void send_all(int fd, const char *data, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if(sent <= 0)
+            return;
+        data += sent;
+        size -= sent;
+    }
+}
+
+// answers one request per connection, polling for the stop flag in 
+// between; only GET /metrics is served
+void *metrics_server_func(void *arg)
+{
+    int listen_fd = (int)(intptr_t)arg;
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    while(!metrics_stop.load(std::memory_order_acquire))
+    {
+        if(poll(&pfd, 1, 100) <= 0)
+            continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0)
+            continue;
+        
+        // the request line is all that's needed, and a client sending 
+        // nothing doesn't hold the server for long
+        char request[1024];
+        struct pollfd client = {fd, POLLIN, 0};
+        ssize_t len = poll(&client, 1, 1000) > 0 ? 
+            recv(fd, request, sizeof(request) - 1, 0) : 0;
+        request[len > 0 ? len : 0] = '\0';
+        
+        std::string response;
+        if(!strncmp(request, "GET /metrics ", 13))
+        {
+            std::string body = render_metrics();
+            char header[256];
+            snprintf(header, sizeof(header), 
+                "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %zu\r\n"
+                "Connection: close\r\n\r\n", body.size());
+            response = header + body;
+        }
+        else
+            response = "HTTP/1.0 404 Not Found\r\n"
+                "Content-Length: 0\r\nConnection: close\r\n\r\n";
+        send_all(fd, response.data(), response.size());
+        close(fd);
+    }
+    close(listen_fd);
+    return NULL;
+}
@@ -21,6 +21,9 @@ function main()
     test_invalid_input
     test_invalid_fields_number
     test_valid_input
+    test_trace_round_trip
+    test_baseline_comparison
+    test_machine_readable_output
 }
 
 # simple assertion; you can pass a command to execute,
@@ -64,6 +67,40 @@ function test_invalid_args
     assert "[ $? == 0 ]"
     ./pq_bench_test -v 2>&1 | grep "missing mandatory argument" > /dev/null
     assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --duration 10x 2>&1 | grep "invalid value for argument --duration" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --duration 1m --warmup-time 2m 2>&1 | grep "must be shorter than --duration" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --iterations 0 2>&1 | grep "invalid value for argument --iterations" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --warmup -1 2>&1 | grep "invalid value for argument --warmup" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --query-b x --ab-order blah 2>&1 | grep "invalid value for argument --ab-order" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --threshold p51=3 2>&1 | grep "invalid value for argument --threshold" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --compare-baseline i_dont_exist 2>&1 | grep "cannot open baseline file" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --format xml 2>&1 | grep "invalid value for argument --format" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --trace-sample 0 2>&1 | grep "invalid value for argument --trace-sample" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test --trace-dump i_dont_exist 2>&1 | grep "cannot open trace file" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --clock hpet 2>&1 | grep "invalid value for argument --clock" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --wait-events 0ms 2>&1 | grep "invalid value for argument --wait-events" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --wait-events-report 0s 2>&1 | grep "invalid value for argument --wait-events-report" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --explain-top 0 2>&1 | grep "invalid value for argument --explain-top" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --background 0s 2>&1 | grep "invalid value for argument --background" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --plans 1.5 2>&1 | grep "invalid value for argument --plans" > /dev/null
+    assert "[ $? == 0 ]"
+    ./pq_bench_test -n 1 --metrics-port 0 2>&1 | grep "invalid value for argument --metrics-port" > /dev/null
+    assert "[ $? == 0 ]"
     echo OK
 }
 
@@ -121,4 +158,70 @@ EOF
     echo OK
 }
 
+# the trace written by the run is read back by --trace-dump,
+# one record per query with its input parameters
+function test_trace_round_trip
+{
+    printf "check if query trace is written and read back... "
+    TRACE_FILE=$(mktemp)
+    cat << EOF | ./pq_bench_test -n 1 --trace $TRACE_FILE >/dev/null 2>&1
+hostname,start_time,end_time
+host_000008,2017-01-01 08:59:22,2017-01-01 09:59:22
+host_000001,2017-01-02 13:02:02,2017-01-02 14:02:02
+EOF
+    assert "[ $? == 0 ]"
+    ./pq_bench_test --trace-dump $TRACE_FILE 2>&1 | grep -c \
+        -e "^0,0,A,host_000008,2017-01-01 08:59:22,2017-01-01 09:59:22," \
+        -e "^0,0,A,host_000001,2017-01-02 13:02:02,2017-01-02 14:02:02," \
+        | grep "^2$" >/dev/null
+    assert "[ $? == 0 ]"
+    rm -f $TRACE_FILE
+    echo OK
+}
+
+# a baseline saved by one run is loaded by the next one, which compares
+# against it; with a threshold that loose, no regression is reported
+function test_baseline_comparison
+{
+    printf "check if baseline is saved and compared against... "
+    BASELINE_FILE=$(mktemp)
+    cat << EOF | ./pq_bench_test -n 1 --save-baseline $BASELINE_FILE >/dev/null 2>&1
+hostname,start_time,end_time
+host_000008,2017-01-01 08:59:22,2017-01-01 09:59:22
+host_000001,2017-01-02 13:02:02,2017-01-02 14:02:02
+EOF
+    assert "[ $? == 0 ]"
+    OUTPUT=$(cat << EOF | ./pq_bench_test -n 1 --compare-baseline $BASELINE_FILE --threshold 1000 2>&1
+hostname,start_time,end_time
+host_000008,2017-01-01 08:59:22,2017-01-01 09:59:22
+host_000001,2017-01-02 13:02:02,2017-01-02 14:02:02
+EOF
+)
+    assert "[ $? == 0 ]"
+    echo "$OUTPUT" | grep "Comparison with baseline" >/dev/null
+    assert "[ $? == 0 ]"
+    rm -f $BASELINE_FILE
+    echo OK
+}
+
+# the same, but checking the machine-readable summaries,
+# which go to stdout when no output file is given
+function test_machine_readable_output
+{
+    printf "check if machine-readable summary is produced... "
+    cat << EOF | ./pq_bench_test -n 1 --format json 2>/dev/null | egrep '"queries": 2,' >/dev/null
+hostname,start_time,end_time
+host_000008,2017-01-01 08:59:22,2017-01-01 09:59:22
+host_000001,2017-01-02 13:02:02,2017-01-02 14:02:02
+EOF
+    assert "[ $? == 0 ]"
+    cat << EOF | ./pq_bench_test -n 1 --format csv 2>/dev/null | egrep "^summary,,queries,2$" >/dev/null
+hostname,start_time,end_time
+host_000008,2017-01-01 08:59:22,2017-01-01 09:59:22
+host_000001,2017-01-02 13:02:02,2017-01-02 14:02:02
+EOF
+    assert "[ $? == 0 ]"
+    echo OK
+}
+
 main "$@"
\ No newline at end of file